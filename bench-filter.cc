@@ -0,0 +1,200 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <regex>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#include <qpdf/QPDF.hh>
+#include <qpdf/QPDFObjectHandle.hh>
+#include <qpdf/QPDFPageDocumentHelper.hh>
+#include <qpdf/QPDFPageObjectHelper.hh>
+#include <qpdf/QPDFTokenizer.hh>
+#include <qpdf/QUtil.hh>
+
+#include "filter.hh"
+
+// Count every allocation made through the global operator new, so that the
+// allocations made by the filter can be measured
+size_t allocations = 0;
+
+void *operator new(size_t size) {
+    allocations++;
+    if (auto ptr = malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept { free(ptr); }
+
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+
+// Struct to hold the command-line arguments
+struct args_t {
+    const char *whoami, *regex;
+    unsigned long iterations = 10;
+    vector<const char *> files;
+};
+
+// Print usage and exit
+void usage(args_t &args) {
+    cerr << "Usage: " << args.whoami << " [--iterations n] regex infile..."
+         << endl;
+    exit(2);
+}
+
+// Parse command-line arguments
+void parseArgs(int argc, char *argv[], args_t &args) {
+    args.whoami = QUtil::getWhoami(argv[0]);
+    for (auto i = 1; i < argc; i++) {
+        if (string(argv[i]) == "--iterations" && i + 1 < argc) {
+            try {
+                args.iterations = stoul(argv[++i]);
+            } catch (logic_error &) {
+                usage(args);
+            }
+        } else if (argv[i][0] == '-') {
+            usage(args);
+        } else if (!args.regex) {
+            args.regex = argv[i];
+        } else {
+            args.files.push_back(argv[i]);
+        }
+    }
+    if (!args.regex || args.files.empty() || !args.iterations) {
+        usage(args);
+    }
+}
+
+// Class implementing a token filter which records the tokens of a stream, along
+// with the text shown by each operator, text object and the stream as a whole
+// (i.e. the text the filter tests at each scope)
+class Recorder : public QPDFObjectHandle::TokenFilter {
+    string _operator, _text_object, _stream;
+
+  public:
+    vector<QPDFTokenizer::Token> tokens;
+    vector<string> samples[3];
+
+    void handleToken(const QPDFTokenizer::Token &token) {
+        tokens.push_back(token);
+        if (token.getType() == QPDFTokenizer::tt_string) {
+            _operator += token.getValue();
+            _text_object += token.getValue();
+            _stream += token.getValue();
+        } else if (token.getType() == QPDFTokenizer::tt_word) {
+            if (!_operator.empty()) {
+                samples[0].push_back(move(_operator));
+                _operator.clear();
+            }
+            if (token.getValue() == "ET" && !_text_object.empty()) {
+                samples[1].push_back(move(_text_object));
+                _text_object.clear();
+            }
+        }
+    }
+
+    void handleEOF() {
+        if (!_stream.empty()) {
+            samples[2].push_back(move(_stream));
+            _stream.clear();
+        }
+    }
+};
+
+// Names of the scopes at which text samples are recorded; index matches
+// Recorder::samples
+const char *const SAMPLE_NAMES[] = {"operator", "text_object", "stream"};
+
+int main(int argc, char *argv[]) {
+    args_t args{};
+    parseArgs(argc, argv, args);
+
+    try {
+        // Record the tokens of every page content stream up front, so that
+        // neither parsing nor tokenizing is included in the measurements
+        vector<vector<QPDFTokenizer::Token>> streams;
+        vector<string> samples[3];
+        size_t tokens = 0;
+        for (auto file : args.files) {
+            QPDF pdf;
+            pdf.processFile(file);
+            for (auto &page : QPDFPageDocumentHelper(pdf).getAllPages()) {
+                for (auto &obj : page.getObjectHandle().getPageContents()) {
+                    Recorder recorder;
+                    obj.filterAsContents(&recorder);
+                    tokens += recorder.tokens.size();
+                    streams.push_back(move(recorder.tokens));
+                    for (auto i = 0; i < 3; i++) {
+                        samples[i].insert(samples[i].end(),
+                                          recorder.samples[i].begin(),
+                                          recorder.samples[i].end());
+                    }
+                }
+            }
+        }
+        if (!tokens) {
+            throw runtime_error("no content stream tokens found");
+        }
+
+        // Measure the filter at each scope with no rules, so that only the
+        // filter itself (and not the regex) is measured
+        vector<rule_t> rules;
+        printf("%-15s %10s %12s\n", "filter scope", "ns/token", "allocs/token");
+        for (auto scope = 0; scope < 6; scope++) {
+            stats_t stats{};
+            auto start = chrono::steady_clock::now();
+            auto before = allocations;
+            for (auto i = 0ul; i < args.iterations; i++) {
+                for (auto &stream : streams) {
+                    Filter filter(rules, scope_t(scope), stats);
+                    for (auto &token : stream) {
+                        filter.handleToken(token);
+                    }
+                    filter.handleEOF();
+                }
+            }
+            chrono::duration<double, nano> elapsed =
+                chrono::steady_clock::now() - start;
+            double count = tokens * args.iterations;
+            printf("%-15s %10.1f %12.2f\n", SCOPE_NAMES[scope],
+                   elapsed.count() / count, (allocations - before) / count);
+        }
+
+        // Measure the regex alone against the text tested at each scope
+        regex expr(args.regex);
+        printf("\n%-15s %10s %10s %10s\n", "regex sample", "bytes", "ns/sample",
+               "MB/s");
+        for (auto i = 0; i < 3; i++) {
+            if (samples[i].empty()) {
+                continue;
+            }
+            size_t bytes = 0;
+            for (auto &sample : samples[i]) {
+                bytes += sample.size();
+            }
+            auto start = chrono::steady_clock::now();
+            for (auto j = 0ul; j < args.iterations; j++) {
+                for (auto &sample : samples[i]) {
+                    regex_search(sample, expr);
+                }
+            }
+            chrono::duration<double> elapsed =
+                chrono::steady_clock::now() - start;
+            printf("%-15s %10.1f %10.1f %10.2f\n", SAMPLE_NAMES[i],
+                   double(bytes) / samples[i].size(),
+                   elapsed.count() * 1e9 / samples[i].size() / args.iterations,
+                   bytes * args.iterations / elapsed.count() / 1e6);
+        }
+    } catch (exception &e) {
+        cerr << args.whoami << ": " << e.what() << endl;
+        exit(2);
+    }
+
+    return 0;
+}
@@ -0,0 +1,255 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+#include <qpdf/QPDF.hh>
+#include <qpdf/QPDFPageDocumentHelper.hh>
+#include <qpdf/QUtil.hh>
+
+// Argument flags for each scope, as accepted by redact-pdf
+const string SCOPE_FLAGS = "motqsp";
+
+// Struct to hold the command-line arguments, along with their defaults
+struct args_t {
+    const char *whoami, *baseline, *save;
+    string redact = "redact-pdf";
+    const char *regex = "REDACTME";
+    vector<unsigned long> jobs = {1};
+    unsigned long runs = 3;
+    double threshold = 10;
+    vector<const char *> corpus;
+};
+
+// Print usage and exit
+void usage(args_t &args) {
+    cerr << "Usage: " << args.whoami << " [--redact path] [--regex regex] "
+         << "[--jobs n[,n...]] [--runs n] [--baseline file] [--save file] "
+         << "[--threshold percent] corpus..." << endl;
+    exit(2);
+}
+
+// Parse command-line arguments
+void parseArgs(int argc, char *argv[], args_t &args) {
+    args.whoami = QUtil::getWhoami(argv[0]);
+
+    // Default to the redact-pdf built or installed alongside this tool
+    string self = argv[0];
+    if (self.find('/') != string::npos) {
+        args.redact = self.substr(0, self.rfind('/') + 1) + "redact-pdf";
+    }
+
+    try {
+        for (auto i = 1; i < argc; i++) {
+            string arg = argv[i];
+            if (arg[0] != '-') {
+                args.corpus.push_back(argv[i]);
+            } else if (i + 1 == argc) {
+                usage(args);
+            } else if (arg == "--redact") {
+                args.redact = argv[++i];
+            } else if (arg == "--regex") {
+                args.regex = argv[++i];
+            } else if (arg == "--jobs") {
+                args.jobs.clear();
+                istringstream list(argv[++i]);
+                for (string n; getline(list, n, ',');) {
+                    args.jobs.push_back(stoul(n));
+                }
+            } else if (arg == "--runs") {
+                args.runs = stoul(argv[++i]);
+            } else if (arg == "--baseline") {
+                args.baseline = argv[++i];
+            } else if (arg == "--save") {
+                args.save = argv[++i];
+            } else if (arg == "--threshold") {
+                args.threshold = stod(argv[++i]);
+            } else {
+                usage(args);
+            }
+        }
+    } catch (logic_error &) {
+        // Thrown by stoul/stod for malformed numbers
+        usage(args);
+    }
+    if (args.corpus.empty() || !args.runs) {
+        usage(args);
+    }
+    for (auto jobs : args.jobs) {
+        if (!jobs) {
+            usage(args);
+        }
+    }
+}
+
+// Struct to hold the measurements for a single configuration
+struct result_t {
+    double pages, megabytes, rss;
+};
+
+// Key identifying a configuration, by scope flag and job count
+typedef pair<char, unsigned long> config_t;
+
+// Run redact-pdf over the corpus with the given scope, keeping up to the given
+// number of worker processes running at once; return the elapsed time and
+// record the peak RSS (in kilobytes) of any single worker
+double runCorpus(args_t &args, char scope, unsigned long jobs, long &rss) {
+    auto tmpdir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    auto prefix = string(tmpdir) + "/bench-pdf-" + to_string(getpid()) + "-";
+    auto flag = string("-") + scope;
+    auto start = chrono::steady_clock::now();
+
+    size_t next = 0, running = 0;
+    while (next < args.corpus.size() || running) {
+        if (next < args.corpus.size() && running < jobs) {
+            auto outfile = prefix + to_string(next) + ".pdf";
+            auto pid = fork();
+            if (pid == 0) {
+                execlp(args.redact.c_str(), args.redact.c_str(), flag.c_str(),
+                       args.regex, args.corpus[next], outfile.c_str(),
+                       nullptr);
+                perror(args.redact.c_str());
+                _exit(127);
+            } else if (pid < 0) {
+                throw runtime_error("unable to start worker");
+            }
+            next++;
+            running++;
+            continue;
+        }
+
+        int status;
+        rusage usage;
+        if (wait4(-1, &status, 0, &usage) < 0) {
+            throw runtime_error("unable to wait for worker");
+        }
+        running--;
+        if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+            throw runtime_error("worker failed running " + args.redact);
+        }
+        rss = max(rss, usage.ru_maxrss);
+    }
+
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    for (size_t i = 0; i < args.corpus.size(); i++) {
+        remove((prefix + to_string(i) + ".pdf").c_str());
+    }
+    return elapsed.count();
+}
+
+// Read a baseline file, as written by saveResults
+map<config_t, result_t> loadResults(const char *file) {
+    map<config_t, result_t> results;
+    ifstream in(file);
+    if (!in) {
+        throw runtime_error(string("unable to read ") + file);
+    }
+    for (string line; getline(in, line);) {
+        istringstream fields(line);
+        config_t config;
+        result_t result;
+        if (line[0] != '#' && fields >> config.first >> config.second >>
+                                  result.pages >> result.megabytes >>
+                                  result.rss) {
+            results[config] = result;
+        }
+    }
+    return results;
+}
+
+// Write results in a form that can be used as a baseline
+void saveResults(const char *file, map<config_t, result_t> &results) {
+    ofstream out(file);
+    out << "# scope jobs pages/s MB/s peak-RSS-MB" << endl;
+    for (auto &entry : results) {
+        out << entry.first.first << " " << entry.first.second << " "
+            << entry.second.pages << " " << entry.second.megabytes << " "
+            << entry.second.rss << endl;
+    }
+    if (!out) {
+        throw runtime_error(string("unable to write ") + file);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    args_t args{};
+    parseArgs(argc, argv, args);
+
+    auto regressed = false;
+    try {
+        // Measure the corpus once up front
+        double pages = 0, megabytes = 0;
+        for (auto file : args.corpus) {
+            QPDF pdf;
+            pdf.processFile(file);
+            pages += QPDFPageDocumentHelper(pdf).getAllPages().size();
+            struct stat info;
+            if (stat(file, &info) == 0) {
+                megabytes += info.st_size / 1e6;
+            }
+        }
+
+        map<config_t, result_t> baseline;
+        if (args.baseline) {
+            baseline = loadResults(args.baseline);
+        }
+
+        // Run each configuration, keeping the fastest of the runs to reduce
+        // noise, and compare it against the baseline
+        map<config_t, result_t> results;
+        printf("%-5s %4s %10s %10s %12s\n", "scope", "jobs", "pages/s", "MB/s",
+               "peak RSS MB");
+        for (auto scope : SCOPE_FLAGS) {
+            for (auto jobs : args.jobs) {
+                double best = 0;
+                long rss = 0;
+                for (auto run = 0ul; run < args.runs; run++) {
+                    auto elapsed = runCorpus(args, scope, jobs, rss);
+                    best = run ? min(best, elapsed) : elapsed;
+                }
+                result_t result{pages / best, megabytes / best, rss / 1024.0};
+                results[{scope, jobs}] = result;
+                printf("-%-4c %4lu %10.1f %10.2f %12.1f\n", scope, jobs,
+                       result.pages, result.megabytes, result.rss);
+
+                auto found = baseline.find({scope, jobs});
+                if (found == baseline.end()) {
+                    continue;
+                }
+                auto &base = found->second;
+                auto slack = args.threshold / 100;
+                if (result.pages < base.pages * (1 - slack) ||
+                    result.megabytes < base.megabytes * (1 - slack) ||
+                    result.rss > base.rss * (1 + slack)) {
+                    printf("  regression: baseline %.1f pages/s, %.2f MB/s, "
+                           "%.1f MB\n",
+                           base.pages, base.megabytes, base.rss);
+                    regressed = true;
+                }
+            }
+        }
+
+        if (args.save) {
+            saveResults(args.save, results);
+        }
+    } catch (exception &e) {
+        cerr << args.whoami << ": " << e.what() << endl;
+        exit(2);
+    }
+
+    return regressed ? 1 : 0;
+}
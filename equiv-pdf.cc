@@ -0,0 +1,247 @@
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+#include <qpdf/QPDF.hh>
+#include <qpdf/QPDFAnnotationObjectHelper.hh>
+#include <qpdf/QPDFObjectHandle.hh>
+#include <qpdf/QPDFPageDocumentHelper.hh>
+#include <qpdf/QPDFPageObjectHelper.hh>
+#include <qpdf/QUtil.hh>
+
+// Argument flags for each scope, as accepted by redact-pdf
+const string SCOPE_FLAGS = "motqsp";
+
+// Struct to hold the command-line arguments
+struct args_t {
+    const char *whoami, *reference, *candidate;
+    vector<const char *> regexes, rulefiles, corpus;
+};
+
+// Print usage and exit
+void usage(args_t &args) {
+    cerr << "Usage: " << args.whoami << " [--regex regex]... "
+         << "[--rules file]... reference candidate corpus..." << endl;
+    exit(2);
+}
+
+// Parse command-line arguments
+void parseArgs(int argc, char *argv[], args_t &args) {
+    args.whoami = QUtil::getWhoami(argv[0]);
+    for (auto i = 1; i < argc; i++) {
+        if (string(argv[i]) == "--regex" && i + 1 < argc) {
+            args.regexes.push_back(argv[++i]);
+        } else if (string(argv[i]) == "--rules" && i + 1 < argc) {
+            args.rulefiles.push_back(argv[++i]);
+        } else if (argv[i][0] == '-') {
+            usage(args);
+        } else if (!args.reference) {
+            args.reference = argv[i];
+        } else if (!args.candidate) {
+            args.candidate = argv[i];
+        } else {
+            args.corpus.push_back(argv[i]);
+        }
+    }
+    if (args.corpus.empty()) {
+        usage(args);
+    }
+    if (args.regexes.empty() && args.rulefiles.empty()) {
+        args.regexes.push_back("REDACTME");
+    }
+}
+
+// Run a redact-pdf binary with the given arguments, throwing if it fails
+void run(const char *redact, vector<const char *> argv) {
+    argv.insert(argv.begin(), redact);
+    argv.push_back(nullptr);
+    auto pid = fork();
+    if (pid == 0) {
+        execvp(redact, (char *const *)argv.data());
+        perror(redact);
+        _exit(127);
+    }
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status)) {
+        throw runtime_error(string("failed running ") + redact);
+    }
+}
+
+// Add the streams of a dictionary (e.g. /XObject of resources) to those found,
+// optionally only those of the given subtype
+void addStreams(QPDFObjectHandle dict, vector<QPDFObjectHandle> &found,
+                const char *subtype = nullptr) {
+    if (!dict.isDictionary()) {
+        return;
+    }
+    for (auto &entry : dict.getDictAsMap()) {
+        auto &stream = entry.second;
+        if (stream.isStream() &&
+            (!subtype ||
+             stream.getDict().getKey("/Subtype").isNameAndEquals(subtype))) {
+            found.push_back(stream);
+        }
+    }
+}
+
+// Find the content streams among resources, as redact-pdf does: form
+// XObjects, tiling patterns and the glyph procedures of Type3 fonts, along with
+// those among the resources of each (indirect) font, visited once
+void findStreams(QPDFObjectHandle resources, vector<QPDFObjectHandle> &found,
+                 set<QPDFObjGen> &seen) {
+    if (!resources.isDictionary()) {
+        return;
+    }
+    addStreams(resources.getKey("/XObject"), found, "/Form");
+    addStreams(resources.getKey("/Pattern"), found);
+    auto fonts = resources.getKey("/Font");
+    if (!fonts.isDictionary()) {
+        return;
+    }
+    for (auto &entry : fonts.getDictAsMap()) {
+        auto &font = entry.second;
+        if (!font.isDictionaryOfType("/Font", "/Type3") ||
+            (font.isIndirect() && !seen.insert(font.getObjGen()).second)) {
+            continue;
+        }
+        addStreams(font.getKey("/CharProcs"), found);
+        if (font.isIndirect()) {
+            findStreams(font.getKey("/Resources"), found, seen);
+        }
+    }
+}
+
+// Collect the decoded data of every content stream of a page or content
+// stream, followed by those found among its resources and (for a page) the
+// appearance streams of its annotations, each visited once
+void collectStreams(QPDFPageObjectHelper page, vector<string> &streams,
+                    set<QPDFObjGen> &seen) {
+    auto object = page.getObjectHandle();
+    auto contents = object.isPageObject() ? object.getPageContents()
+                                          : vector<QPDFObjectHandle>{object};
+    for (auto &obj : contents) {
+        auto data = obj.getStreamData();
+        streams.emplace_back((char *)data->getBuffer(), data->getSize());
+    }
+
+    vector<QPDFObjectHandle> found;
+    findStreams(object.isStream() ? object.getDict().getKey("/Resources")
+                                  : page.getAttribute("/Resources", false),
+                found, seen);
+    if (object.isPageObject()) {
+        for (auto &annot : page.getAnnotations()) {
+            auto appearances = annot.getObjectHandle().getKey("/AP");
+            if (!appearances.isDictionary()) {
+                continue;
+            }
+            for (auto type : {"/N", "/R", "/D"}) {
+                auto value = appearances.getKey(type);
+                if (value.isStream()) {
+                    found.push_back(value);
+                } else {
+                    addStreams(value, found);
+                }
+            }
+        }
+    }
+    for (auto &stream : found) {
+        if (seen.insert(stream.getObjGen()).second) {
+            collectStreams(QPDFPageObjectHelper(stream), streams, seen);
+        }
+    }
+}
+
+// Compare the outputs of the reference and candidate, returning a description
+// of the first difference found, or an empty string if they are equivalent
+string compare(const string &reference, const string &candidate) {
+    QPDF pdfs[2];
+    pdfs[0].processFile(reference.c_str());
+    pdfs[1].processFile(candidate.c_str());
+    auto pages0 = QPDFPageDocumentHelper(pdfs[0]).getAllPages();
+    auto pages1 = QPDFPageDocumentHelper(pdfs[1]).getAllPages();
+    if (pages0.size() != pages1.size()) {
+        return "page count " + to_string(pages0.size()) + " vs. " +
+               to_string(pages1.size());
+    }
+    for (size_t i = 0; i < pages0.size(); i++) {
+        vector<string> streams0, streams1;
+        set<QPDFObjGen> seen0, seen1;
+        collectStreams(pages0[i], streams0, seen0);
+        collectStreams(pages1[i], streams1, seen1);
+        if (streams0.size() != streams1.size()) {
+            return "page " + to_string(i + 1) + " stream count";
+        }
+        for (size_t j = 0; j < streams0.size(); j++) {
+            if (streams0[j] != streams1[j]) {
+                return "page " + to_string(i + 1) + " stream " +
+                       to_string(j + 1) + " data";
+            }
+        }
+    }
+    return "";
+}
+
+int main(int argc, char *argv[]) {
+    args_t args{};
+    parseArgs(argc, argv, args);
+
+    // Each rule set is either a single regex or a rule file
+    vector<vector<const char *>> rulesets;
+    for (auto regex : args.regexes) {
+        rulesets.push_back({regex});
+    }
+    for (auto rulefile : args.rulefiles) {
+        rulesets.push_back({"--rules", rulefile});
+    }
+
+    auto tmpdir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    auto prefix = string(tmpdir) + "/equiv-pdf-" + to_string(getpid()) + "-";
+    auto reference = prefix + "reference.pdf";
+    auto candidate = prefix + "candidate.pdf";
+
+    size_t checked = 0, differed = 0;
+    try {
+        for (auto file : args.corpus) {
+            for (auto &rules : rulesets) {
+                for (auto scope : SCOPE_FLAGS) {
+                    auto flag = string("-") + scope;
+                    vector<const char *> argv{flag.c_str()};
+                    argv.insert(argv.end(), rules.begin(), rules.end());
+                    argv.push_back(file);
+
+                    argv.push_back(reference.c_str());
+                    run(args.reference, argv);
+                    argv.back() = candidate.c_str();
+                    run(args.candidate, argv);
+
+                    auto difference = compare(reference, candidate);
+                    checked++;
+                    if (!difference.empty()) {
+                        differed++;
+                        cout << file << " " << flag << " "
+                             << rules.back() << ": " << difference << endl;
+                    }
+                }
+            }
+        }
+    } catch (exception &e) {
+        cerr << args.whoami << ": " << e.what() << endl;
+        remove(reference.c_str());
+        remove(candidate.c_str());
+        exit(2);
+    }
+    remove(reference.c_str());
+    remove(candidate.c_str());
+
+    cout << checked << " checked, " << differed << " differed" << endl;
+    return differed ? 1 : 0;
+}
@@ -0,0 +1,686 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <regex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+#include <qpdf/QPDFObjectHandle.hh>
+#include <qpdf/QPDFTokenizer.hh>
+
+// USDT probes for tracing with bpftrace, perf, etc.; these compile to a single
+// no-op instruction each, and compile out entirely if sys/sdt.h is unavailable
+// (passing their arguments to an empty function, so they still count as used)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define PROBE(...) STAP_PROBEV(redact_pdf, __VA_ARGS__)
+#else
+template <typename... T> inline void probe(const T &...) {}
+#define PROBE(name, ...) probe(__VA_ARGS__)
+#endif
+
+// Enum representing the scope at which the redaction will take place
+enum scope_t {
+    // Redact only the matching text
+    s_match,
+    // Redact the operator (e.g. Tj) containing the matching text
+    s_operator,
+    // Redact the text object (BT/ET) containing the matching text
+    s_text_object,
+    // Redact the graphics state block (q/Q) containing the matching text
+    s_graphics_state,
+    // Redact the content stream containing the matching text
+    s_stream,
+    // Redact the page containing the matching text
+    s_page
+};
+
+// Argument flags used to set scope; index matches enum
+const string SCOPE_FLAGS = "motqsp";
+
+// Names used to report scopes; index matches enum
+const char *const SCOPE_NAMES[] = {"match",          "operator", "text_object",
+                                   "graphics_state", "stream",   "page"};
+
+// Shorthand for which scopes contain start/end operators, and so can be nested
+inline bool nestable(scope_t scope) {
+    return scope == s_text_object || scope == s_graphics_state;
+}
+
+// Struct to hold a compiled rule, along with counters used to attribute the
+// cost of matching to it
+struct rule_t {
+    string pattern;
+    regex expr;
+
+    // Whether the rule only applies to invisible text (e.g. the text layer
+    // of a scanned document)
+    bool invisible;
+
+    size_t evaluations = 0, matches = 0;
+    double time = 0;
+};
+
+// Enum representing the phases of a run, in the order they take place
+enum phase_t { p_parse, p_redact, p_prune, p_write };
+
+// Names used to report phases; index matches enum
+const char *const PHASE_NAMES[] = {"parse", "redact", "prune", "write"};
+
+// Enum representing the classes of operators, used to report the operator mix
+// of a stream
+enum op_class_t {
+    // Show text (e.g. Tj)
+    o_text,
+    // Begin or end a text object, or set the text state or position
+    o_text_state,
+    // Construct, paint or clip a path
+    o_path,
+    // Save, restore or set the graphics state
+    o_graphics_state,
+    // Set the color or color space
+    o_color,
+    // Draw an XObject, inline image or shading
+    o_xobject,
+    // Mark content
+    o_marked_content,
+    // Anything else
+    o_other
+};
+
+// Names used to report classes of operators; index matches enum
+const char *const OP_CLASS_NAMES[] = {
+    "text",  "text_state", "path",           "graphics_state",
+    "color", "xobject",    "marked_content", "other"};
+
+// Pack an operator of up to four characters into an integer, so that it can be
+// switched on
+constexpr uint32_t opKey(const char *op, uint32_t key = 0) {
+    return *op ? opKey(op + 1, key << 8 | uint8_t(*op)) : key;
+}
+
+// Get the class of an operator; as this is called for every operator, it
+// switches on the operator rather than hashing it
+inline op_class_t classify(const string &op) {
+    if (op.size() > 3) {
+        return o_other;
+    }
+    switch (opKey(op.c_str())) {
+    case opKey("Tj"):
+    case opKey("TJ"):
+    case opKey("'"):
+    case opKey("\""):
+        return o_text;
+    case opKey("BT"):
+    case opKey("ET"):
+    case opKey("Tc"):
+    case opKey("Tw"):
+    case opKey("Tz"):
+    case opKey("TL"):
+    case opKey("Tf"):
+    case opKey("Tr"):
+    case opKey("Ts"):
+    case opKey("Td"):
+    case opKey("TD"):
+    case opKey("Tm"):
+    case opKey("T*"):
+        return o_text_state;
+    case opKey("m"):
+    case opKey("l"):
+    case opKey("c"):
+    case opKey("v"):
+    case opKey("y"):
+    case opKey("h"):
+    case opKey("re"):
+    case opKey("S"):
+    case opKey("s"):
+    case opKey("f"):
+    case opKey("F"):
+    case opKey("f*"):
+    case opKey("B"):
+    case opKey("B*"):
+    case opKey("b"):
+    case opKey("b*"):
+    case opKey("n"):
+    case opKey("W"):
+    case opKey("W*"):
+        return o_path;
+    case opKey("q"):
+    case opKey("Q"):
+    case opKey("cm"):
+    case opKey("w"):
+    case opKey("J"):
+    case opKey("j"):
+    case opKey("M"):
+    case opKey("d"):
+    case opKey("ri"):
+    case opKey("i"):
+    case opKey("gs"):
+        return o_graphics_state;
+    case opKey("CS"):
+    case opKey("cs"):
+    case opKey("SC"):
+    case opKey("SCN"):
+    case opKey("sc"):
+    case opKey("scn"):
+    case opKey("G"):
+    case opKey("g"):
+    case opKey("RG"):
+    case opKey("rg"):
+    case opKey("K"):
+    case opKey("k"):
+        return o_color;
+    case opKey("Do"):
+    case opKey("BI"):
+    case opKey("ID"):
+    case opKey("EI"):
+    case opKey("sh"):
+        return o_xobject;
+    case opKey("BMC"):
+    case opKey("BDC"):
+    case opKey("EMC"):
+    case opKey("MP"):
+    case opKey("DP"):
+        return o_marked_content;
+    default:
+        return o_other;
+    }
+}
+
+// Struct to hold the profile of a content stream, or of all the content streams
+// (including those of form XObjects) of a page
+struct profile_t {
+    // Object number of the stream or page, and index of the page
+    int object, page;
+
+    // Number of streams (for a page), bytes and tokens they contain, and the
+    // maximum nesting depth of graphics states and text objects
+    size_t streams, bytes, tokens, depth;
+
+    // Number of operators of each class
+    size_t operators[8];
+
+    // Total time spent, and the part of it spent matching rules, in seconds
+    double time, regex_time;
+};
+
+// Upper bounds of the buckets of the page latency histogram, in seconds
+const double PAGE_BUCKETS[] = {0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1,
+                               0.25,  0.5,    1,     2.5,  5,     10};
+
+// Struct to hold the statistics collected over a run
+struct stats_t {
+    // Documents redacted successfully, and those that failed
+    size_t documents_ok, documents_failed;
+
+    // Wall-clock and CPU time spent in each phase, in seconds
+    pair<double, double> time[4];
+
+    // Bytes allocated in each phase, if built with allocation counting
+    size_t allocated[4];
+
+    // Bytes of stream data passed through the filter, and bytes written back
+    size_t decoded, encoded;
+
+    // Tokens processed and frames flushed by the filter
+    size_t tokens, frames;
+
+    // Marked-content blocks and XObjects drawn removed along with their
+    // optional content group
+    size_t layers;
+
+    // Matches found, indexed by the scope at which they were redacted
+    size_t matches[6];
+
+    // Pages and streams containing matches (touched) or not (skipped); pages
+    // removed entirely are also counted as touched
+    size_t pages_touched, pages_skipped, pages_removed;
+    size_t streams_touched, streams_skipped;
+
+    // Histogram of the time spent redacting each page, counting the pages in
+    // each bucket (i.e. not cumulatively) with the last counting the rest,
+    // and the total time spent
+    size_t page_buckets[14];
+    double page_seconds;
+
+    // Profile of the page currently being redacted, and the profiles of the
+    // slowest pages and streams so far (each kept as a min-heap on time)
+    profile_t page;
+    vector<profile_t> slowest_pages, slowest_streams;
+};
+
+// Test whether any rule matches the given text (to be redacted at the given
+// scope), stopping at the first match; rules only applying to invisible text
+// are tested against the part of it shown invisibly, if any. The time spent
+// is attributed to each rule evaluated, and added to the given total
+inline bool searchRules(vector<rule_t> &rules, scope_t scope,
+                        const string &text, const string &invisible,
+                        double &total) {
+    for (auto &rule : rules) {
+        if (rule.invisible && invisible.empty()) {
+            continue;
+        }
+        auto start = chrono::steady_clock::now();
+        auto found = regex_search(rule.invisible ? invisible : text, rule.expr);
+        chrono::duration<double> time = chrono::steady_clock::now() - start;
+        rule.evaluations++;
+        rule.time += time.count();
+        total += time.count();
+        if (found) {
+            rule.matches++;
+            PROBE(match, scope, rule.pattern.c_str());
+            return true;
+        }
+    }
+    return false;
+}
+
+// Test whether any rule matches the given text, which isn't shown (e.g. an
+// annotation's text)
+inline bool searchRules(vector<rule_t> &rules, scope_t scope,
+                        const string &text, double &total) {
+    static const string none;
+    return searchRules(rules, scope, text, none, total);
+}
+
+// Remove the matches of every rule from the given text, skipping those only
+// applying to invisible text unless it is; the time spent is attributed to
+// each rule, and added to the given total
+inline string replaceRules(vector<rule_t> &rules, scope_t scope,
+                           const string &text, double &total,
+                           bool invisible = false) {
+    auto result = text;
+    for (auto &rule : rules) {
+        if (rule.invisible && !invisible) {
+            continue;
+        }
+        auto start = chrono::steady_clock::now();
+        auto replaced = regex_replace(result, rule.expr, "");
+        chrono::duration<double> time = chrono::steady_clock::now() - start;
+        rule.evaluations++;
+        rule.time += time.count();
+        total += time.count();
+        if (replaced != result) {
+            rule.matches++;
+            PROBE(match, scope, rule.pattern.c_str());
+            result = move(replaced);
+        }
+    }
+    return result;
+}
+
+// Keys holding alternate text, of structure elements and marked-content
+// property lists: the replacement text, alternate description and expansion
+// of an abbreviation
+const char *const ALTERNATE_KEYS[] = {"/ActualText", "/Alt", "/E"};
+
+// Struct to hold the names of the resources (of the stream being filtered)
+// belonging to optional content groups (layers) being removed: the property
+// lists of marked content, and XObjects
+struct layers_t {
+    set<string> properties, xobjects;
+
+    bool empty() const { return properties.empty() && xobjects.empty(); }
+};
+
+// Class implementing a token filter to identify and remove matches at the
+// specified scope; it will handle filtering within the stream and flag
+// matches for redaction at a higher scope
+class Filter : public QPDFObjectHandle::TokenFilter {
+    vector<rule_t> &_rules;
+    scope_t _scope;
+    stats_t &_stats;
+    profile_t _profile{};
+    size_t _depth = 0;
+    size_t _dict = 0;
+    bool _redact = false;
+    bool _removed = false;
+    bool _trim = false;
+
+    // Layers being removed, the depth within a marked-content block being
+    // removed, the last two names (i.e. the operands of BDC or Do), and the
+    // frame (with the sizes of its data and text) at which the operands of
+    // the current operator start
+    layers_t _layers;
+    size_t _hidden = 0;
+    string _tag, _name;
+
+    // The last key of an inline property list (i.e. of the string following
+    // it, if any)
+    string _key;
+    struct {
+        size_t frame, data, text, invisible;
+    } _operands{};
+
+    // Whether any rule only applies to invisible text, in which case the
+    // text render mode (saved and restored along with the graphics state) is
+    // tracked, along with the last integer (i.e. the operand of Tr)
+    bool _conditional;
+    bool _invisible = false;
+    vector<bool> _modes;
+    string _number;
+
+    // Each frame of the stack contains the unwritten raw data (which is being
+    // stored in case it needs to be redacted in the future), the collected
+    // text to test for redaction, and the part of it shown invisibly
+    struct frame_t {
+        string data, text, invisible;
+    };
+    vector<frame_t> _stack;
+
+    // Test whether any rule matches the text of the given frame
+    bool _search(const frame_t &frame) {
+        return searchRules(_rules, _scope, frame.text, frame.invisible,
+                           _profile.regex_time);
+    }
+
+    // Test whether any rule matches the given text, which isn't shown
+    bool _search(const string &text) {
+        return searchRules(_rules, _scope, text, _profile.regex_time);
+    }
+
+    // Remove the matches of every rule from the given text
+    string _replace(const string &text, bool invisible = false) {
+        return replaceRules(_rules, _scope, text, _profile.regex_time,
+                            invisible);
+    }
+
+    // Add a token to the currently active frame, along with the text it shows
+    void _add(const QPDFTokenizer::Token &token, const string &text) {
+        auto &frame = _stack.back();
+        frame.data += token.getRawValue();
+        frame.text += text;
+        if (_invisible) {
+            frame.invisible += text;
+        }
+        _trim = false;
+    }
+
+    // Add a token to the currently active frame
+    void _add(const QPDFTokenizer::Token &token) {
+        static const string none;
+        _add(token, token.getType() == QPDFTokenizer::tt_string
+                        ? token.getValue()
+                        : none);
+    }
+
+    // Flush the currently active frame to the next lower frame
+    void _flush() {
+        auto frame = _stack.back();
+        _stack.pop_back();
+        _stats.frames++;
+
+        // The frame is removed either way, but the data is only added if
+        // it is not being redacted
+        if (!_search(frame)) {
+            auto &top = _stack.back();
+            top.data += frame.data;
+            top.text += frame.text;
+            top.invisible += frame.invisible;
+        } else {
+            _stats.matches[_scope]++;
+
+            // Since the filter is operating on a stream, flag the immediate
+            // next whitespace as also requiring redaction
+            _redact = _trim = true;
+        }
+    }
+
+    // Start a new frame if the desired scope matches the expected scope
+    void _open(scope_t scope) {
+        // Start a new frame only if there is none or the scope is nestable
+        if (_scope == scope && (nestable(scope) || _stack.size() == 1)) {
+            _stack.push_back({});
+        }
+    }
+
+    // Start a new frame if the desired scope matches the expected scope,
+    // and add the given token at the beginning
+    void _start(scope_t scope, const QPDFTokenizer::Token &token) {
+        _open(scope);
+        _add(token);
+    }
+
+    // Add the alternate text of a marked-content property list (e.g.
+    // /ActualText of a BDC operator), which holds a text string rather than
+    // text to show; since removing the operator would leave its marked
+    // content unbalanced, at the operator scope the string itself is blanked
+    // instead
+    void _property(const QPDFTokenizer::Token &token) {
+        auto text =
+            QPDFObjectHandle::newString(token.getValue()).getUTF8Value();
+        auto redacted = text;
+        if (_scope == s_match) {
+            redacted = _replace(text);
+        } else if (_scope == s_operator && _search(text)) {
+            redacted.clear();
+        }
+
+        _open(s_operator);
+        if (redacted == text) {
+            _add(token, _scope == s_match || _scope == s_operator ? "" : text);
+            return;
+        }
+        _stats.matches[_scope]++;
+        _redact = true;
+        auto value = QPDFObjectHandle::newUnicodeString(redacted);
+        _add(QPDFTokenizer::Token(QPDFTokenizer::tt_string,
+                                  value.getStringValue()),
+             "");
+    }
+
+    // Add the given token and flush the current frame if the desired scope
+    // matches the expected scope
+    void _end(scope_t scope, const QPDFTokenizer::Token &token) {
+        _add(token);
+        if (_scope == scope && _stack.size() > 1) {
+            _flush();
+        }
+    }
+
+    // Mark the start of the operands of the next operator
+    void _mark() {
+        auto &frame = _stack.back();
+        _operands = {_stack.size(), frame.data.size(), frame.text.size(),
+                     frame.invisible.size()};
+        _tag.clear();
+        _name.clear();
+    }
+
+    // Remove the operands of the current operator, along with any frames
+    // started by them, then remove the operator itself (by not adding it);
+    // as the whitespace preceding the operands is removed too, that following
+    // the operator is kept
+    void _drop() {
+        _stack.resize(_operands.frame);
+        auto &frame = _stack.back();
+        frame.data.resize(_operands.data);
+        frame.text.resize(_operands.text);
+        frame.invisible.resize(_operands.invisible);
+        _stats.layers++;
+        _removed = true;
+    }
+
+    // Skip a token within a marked-content block being removed, tracking the
+    // nesting of marked content until the end of the block
+    void _hide(const QPDFTokenizer::Token &token) {
+        if (token.getType() != QPDFTokenizer::tt_word) {
+            return;
+        }
+        auto &value = token.getValue();
+        if (value == "BDC" || value == "BMC") {
+            _hidden++;
+        } else if (value == "EMC" && !--_hidden) {
+            _mark();
+        }
+    }
+
+  public:
+    Filter(vector<rule_t> &rules, scope_t scope, stats_t &stats,
+           const layers_t &layers = {})
+        : _rules(rules), _scope(scope), _stats(stats), _layers(layers) {
+        _conditional =
+            any_of(rules.begin(), rules.end(),
+                   [](const rule_t &rule) { return rule.invisible; });
+        _stack.push_back({});
+        _mark();
+    }
+
+    void handleToken(const QPDFTokenizer::Token &token) {
+        auto &value = token.getValue();
+        _stats.tokens++;
+        _stats.decoded += token.getRawValue().size();
+        _profile.tokens++;
+        _profile.bytes += token.getRawValue().size();
+        if (_hidden) {
+            _hide(token);
+            return;
+        }
+        switch (token.getType()) {
+        case QPDFTokenizer::tt_word:
+            _profile.operators[classify(value)]++;
+
+            // Remove marked content and XObjects belonging to layers being
+            // removed, along with their operands
+            if (!_layers.empty()) {
+                if (value == "BDC" && _tag == "/OC" &&
+                    _layers.properties.count(_name)) {
+                    _drop();
+                    _hidden = 1;
+                    break;
+                } else if (value == "Do" && _layers.xobjects.count(_name)) {
+                    _drop();
+                    _mark();
+                    break;
+                }
+            }
+
+            // Mark appropriate start/end operators (which have no arguments) or
+            // the end of an operator block (which may have arguments)
+            if (value == "BT") {
+                _profile.depth = max(_profile.depth, ++_depth);
+                _start(s_text_object, token);
+            } else if (value == "ET") {
+                _depth -= _depth > 0;
+                _end(s_text_object, token);
+            } else if (value == "q") {
+                _profile.depth = max(_profile.depth, ++_depth);
+                _start(s_graphics_state, token);
+                if (_conditional) {
+                    _modes.push_back(_invisible);
+                }
+            } else if (value == "Q") {
+                _depth -= _depth > 0;
+                _end(s_graphics_state, token);
+                if (_conditional && !_modes.empty()) {
+                    _invisible = _modes.back();
+                    _modes.pop_back();
+                }
+            } else if (value == "Tr" && _conditional) {
+                // Neither filling nor stroking (3), or only clipping (7)
+                _invisible = _number == "3" || _number == "7";
+                _end(s_operator, token);
+            } else {
+                _end(s_operator, token);
+            }
+            if (!_layers.empty()) {
+                _mark();
+            }
+            break;
+        case QPDFTokenizer::tt_name:
+            if (!_layers.empty()) {
+                _tag = move(_name);
+                _name = value;
+            }
+            if (_dict) {
+                _key = value;
+            }
+            _start(s_operator, token);
+            break;
+        case QPDFTokenizer::tt_integer:
+            if (_conditional) {
+                _number = value;
+            }
+            _start(s_operator, token);
+            break;
+        case QPDFTokenizer::tt_space:
+            // Add the space token if it should not be trimmed immediately
+            // following a redaction, then unmark the trimming state
+            if (!_trim) {
+                _add(token);
+            }
+            _trim = false;
+            break;
+        case QPDFTokenizer::tt_dict_open:
+            // Dictionaries only appear as property lists of marked content
+            _dict++;
+            _start(s_operator, token);
+            break;
+        case QPDFTokenizer::tt_dict_close:
+            _dict -= _dict > 0;
+            _start(s_operator, token);
+            break;
+        case QPDFTokenizer::tt_string:
+            if (_dict) {
+                // Only alternate text is matched; other strings of property
+                // lists (e.g. /Lang) are kept as they are, and aren't text
+                if (find(begin(ALTERNATE_KEYS), end(ALTERNATE_KEYS), _key) !=
+                    end(ALTERNATE_KEYS)) {
+                    _property(token);
+                } else {
+                    _open(s_operator);
+                    _add(token, "");
+                }
+                break;
+            }
+            if (_scope == s_match) {
+                // For match-scoped redactions, simply replace any matches with
+                // an empty string and replace the string token with the result
+                auto redacted = _replace(value, _invisible);
+                if (redacted != value) {
+                    _stats.matches[s_match]++;
+                    _redact = true;
+                }
+                _add(QPDFTokenizer::Token(QPDFTokenizer::tt_string, redacted));
+                break;
+            }
+        default:
+            // Any other token may be an argument that needs to be trimmed as
+            // part of redacting an operator; since operators can't be nested,
+            // marking this repeatedly is safe
+            _start(s_operator, token);
+            break;
+        }
+    }
+
+    void handleEOF() {
+        // Flush any remaining open frames
+        while (_stack.size() > 1) {
+            _flush();
+        }
+
+        // Test the final text for redaction
+        if (!_redact && _search(_stack[0])) {
+            _stats.matches[_scope]++;
+            _redact = true;
+        }
+    }
+
+    // Get final raw stream data
+    const string &data() { return _stack[0].data; }
+
+    // Whether the final stream contains redactions
+    bool redact() { return _redact; }
+
+    // Whether the final stream has had layers removed
+    bool removed() { return _removed; }
+
+    // Get the profile of the stream (with the counts the filter can collect)
+    profile_t &profile() { return _profile; }
+};
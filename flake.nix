@@ -1,18 +1,25 @@
 {
-  outputs = { nixpkgs, ... }: let
-    systems = fn: nixpkgs.lib.mapAttrs (_: fn) nixpkgs.legacyPackages;
+  outputs = { self, nixpkgs, ... }: let
+    systems = fn: nixpkgs.lib.mapAttrs fn nixpkgs.legacyPackages;
   in {
-    packages = systems (pkgs: {
+    packages = systems (_: pkgs: {
       default = pkgs.stdenv.mkDerivation {
         name = "redact-pdf";
         src = ./.;
-        buildInputs = [ pkgs.qpdf ];
+        buildInputs = [ pkgs.qpdf ]
+          ++ pkgs.lib.optional pkgs.stdenv.isLinux pkgs.libsystemtap;
         buildPhase = "./build";
         installPhase = ''
           mkdir -p "$out/bin"
-          mv redact-pdf "$out/bin"
+          mv redact-pdf gen-pdf bench-pdf bench-filter equiv-pdf "$out/bin"
         '';
       };
     });
+    apps = systems (system: _: {
+      bench = {
+        type = "app";
+        program = "${self.packages.${system}.default}/bin/bench-pdf";
+      };
+    });
   };
 }
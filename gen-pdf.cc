@@ -0,0 +1,250 @@
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#include <qpdf/QPDF.hh>
+#include <qpdf/QPDFObjectHandle.hh>
+#include <qpdf/QPDFPageDocumentHelper.hh>
+#include <qpdf/QPDFPageObjectHelper.hh>
+#include <qpdf/QPDFWriter.hh>
+#include <qpdf/QUtil.hh>
+
+// Struct to hold the command-line arguments, along with their defaults
+struct args_t {
+    const char *whoami, *outfile;
+    const char *match = "REDACTME";
+
+    // Pages in the document, and content streams on each page
+    unsigned long pages = 10, streams = 1;
+
+    // Text objects (BT/ET) in each stream, show-text operators in each text
+    // object, and words in each operator
+    unsigned long objects = 10, strings = 10, words = 5;
+
+    // Depth of graphics state blocks (q/Q) around each text object
+    unsigned long depth = 1;
+
+    // Form XObjects shared by (i.e. drawn on) every page
+    unsigned long forms = 0;
+
+    // Fraction of show-text operators using TJ rather than Tj, and fraction
+    // of words replaced with the match text
+    double tj = 0.5, density = 0.01;
+
+    unsigned long seed = 1;
+};
+
+// Print usage and exit
+void usage(args_t &args) {
+    cerr << "Usage: " << args.whoami << " [--pages n] [--streams n] "
+         << "[--objects n] [--strings n] [--words n] [--depth n] [--forms n] "
+         << "[--tj fraction] [--density fraction] [--match text] [--seed n] "
+         << "outfile" << endl;
+    exit(2);
+}
+
+// Parse command-line arguments
+void parseArgs(int argc, char *argv[], args_t &args) {
+    args.whoami = QUtil::getWhoami(argv[0]);
+    const vector<pair<string, unsigned long *>> counts = {
+        {"--pages", &args.pages},     {"--streams", &args.streams},
+        {"--objects", &args.objects}, {"--strings", &args.strings},
+        {"--words", &args.words},     {"--depth", &args.depth},
+        {"--forms", &args.forms},     {"--seed", &args.seed}};
+    const vector<pair<string, double *>> fractions = {
+        {"--tj", &args.tj}, {"--density", &args.density}};
+    try {
+        for (auto i = 1; i < argc; i++) {
+            string arg = argv[i];
+            auto found = false;
+            if (arg[0] == '-' && i + 1 < argc) {
+                for (auto &count : counts) {
+                    // stoul accepts (and wraps) negative numbers
+                    if (arg == count.first && !strchr(argv[i + 1], '-')) {
+                        *count.second = stoul(argv[++i]);
+                        found = true;
+                    }
+                }
+                for (auto &fraction : fractions) {
+                    if (arg == fraction.first) {
+                        *fraction.second = stod(argv[++i]);
+                        found = true;
+                    }
+                }
+                if (arg == "--match") {
+                    args.match = argv[++i];
+                    found = true;
+                }
+            }
+            if (found) {
+                continue;
+            } else if (arg[0] != '-' && !args.outfile) {
+                args.outfile = argv[i];
+            } else {
+                usage(args);
+            }
+        }
+    } catch (logic_error &) {
+        // Thrown by stoul/stod for malformed numbers
+        usage(args);
+    }
+    if (!args.outfile) {
+        usage(args);
+    }
+    for (auto &fraction : fractions) {
+        if (!(*fraction.second >= 0 && *fraction.second <= 1)) {
+            usage(args);
+        }
+    }
+}
+
+// Class generating content stream data from a seeded random source, so that
+// the same arguments always produce the same document
+class Generator {
+    args_t &_args;
+    mt19937 _random;
+
+    // Generate a random lowercase word
+    string _word() {
+        uniform_int_distribution<> length(3, 8), letter('a', 'z');
+        string word(length(_random), ' ');
+        for (auto &c : word) {
+            c = letter(_random);
+        }
+        return word;
+    }
+
+    // Escape text for use in a literal string
+    static string _escape(const string &text) {
+        string escaped;
+        for (auto c : text) {
+            if (c == '(' || c == ')' || c == '\\') {
+                escaped += '\\';
+            }
+            escaped += c;
+        }
+        return escaped;
+    }
+
+    // Generate a single show-text operator, using either Tj or TJ
+    string _show() {
+        bernoulli_distribution tj(_args.tj), match(_args.density);
+        vector<string> words;
+        for (auto i = 0ul; i < _args.words; i++) {
+            words.push_back(match(_random) ? _args.match : _word());
+        }
+        if (!tj(_random)) {
+            string text;
+            for (auto &word : words) {
+                text += (text.empty() ? "" : " ") + word;
+            }
+            return "(" + _escape(text) + ") Tj";
+        }
+
+        // For TJ, place each word in its own string separated by a kerning
+        // adjustment, as many producers do
+        string array;
+        for (auto &word : words) {
+            array += (array.empty() ? "(" : " -250 (") + _escape(word) + ")";
+        }
+        return "[" + array + "] TJ";
+    }
+
+  public:
+    Generator(args_t &args) : _args(args), _random(args.seed) {}
+
+    // Generate a content stream of nested graphics states and text objects
+    string contents() {
+        string data;
+        for (auto i = 0ul; i < _args.objects; i++) {
+            for (auto d = 0ul; d < _args.depth; d++) {
+                data += "q\n";
+            }
+            data += "BT\n/F1 10 Tf\n72 720 Td\n";
+            for (auto j = 0ul; j < _args.strings; j++) {
+                data += "0 -12 Td\n" + _show() + "\n";
+            }
+            data += "ET\n";
+            for (auto d = 0ul; d < _args.depth; d++) {
+                data += "Q\n";
+            }
+        }
+        return data;
+    }
+};
+
+int main(int argc, char *argv[]) {
+    args_t args{};
+    parseArgs(argc, argv, args);
+
+    try {
+        QPDF pdf;
+        pdf.emptyPDF();
+        Generator generator(args);
+
+        auto font = pdf.makeIndirectObject(QPDFObjectHandle::parse(
+            "<< /Type /Font /Subtype /Type1 /BaseFont /Helvetica >>"));
+        auto fonts = QPDFObjectHandle::newDictionary();
+        fonts.replaceKey("/F1", font);
+
+        // Forms only reference the font, while pages also reference the forms
+        auto form_resources = QPDFObjectHandle::newDictionary();
+        form_resources.replaceKey("/Font", fonts);
+        form_resources = pdf.makeIndirectObject(form_resources);
+        auto resources = QPDFObjectHandle::newDictionary();
+        resources.replaceKey("/Font", fonts);
+
+        // Generate the shared form XObjects, each drawn once per page
+        auto xobjects = QPDFObjectHandle::newDictionary();
+        string draw;
+        for (auto i = 0ul; i < args.forms; i++) {
+            auto form = QPDFObjectHandle::newStream(&pdf, generator.contents());
+            auto dict = form.getDict();
+            dict.replaceKey("/Type", QPDFObjectHandle::newName("/XObject"));
+            dict.replaceKey("/Subtype", QPDFObjectHandle::newName("/Form"));
+            dict.replaceKey("/BBox",
+                            QPDFObjectHandle::parse("[0 0 612 792]"));
+            dict.replaceKey("/Resources", form_resources);
+            auto name = "/Fx" + to_string(i);
+            xobjects.replaceKey(name, form);
+            draw += "q\n" + name + " Do\nQ\n";
+        }
+        if (args.forms) {
+            resources.replaceKey("/XObject", xobjects);
+        }
+        resources = pdf.makeIndirectObject(resources);
+
+        // Generate the pages, drawing the forms after the last stream
+        QPDFPageDocumentHelper doc(pdf);
+        for (auto i = 0ul; i < args.pages; i++) {
+            vector<QPDFObjectHandle> contents;
+            for (auto j = 0ul; j < args.streams; j++) {
+                auto data = generator.contents();
+                if (j + 1 == args.streams) {
+                    data += draw;
+                }
+                contents.push_back(QPDFObjectHandle::newStream(&pdf, data));
+            }
+            auto page = QPDFObjectHandle::parse(
+                "<< /Type /Page /MediaBox [0 0 612 792] >>");
+            page.replaceKey("/Resources", resources);
+            page.replaceKey("/Contents", QPDFObjectHandle::newArray(contents));
+            doc.addPage(pdf.makeIndirectObject(page), false);
+        }
+
+        // Derive the document ID from its contents, so that the output is
+        // reproducible byte-for-byte
+        QPDFWriter writer(pdf, args.outfile);
+        writer.setDeterministicID(true);
+        writer.write();
+    } catch (exception &e) {
+        cerr << args.whoami << ": " << e.what() << endl;
+        exit(2);
+    }
+
+    return 0;
+}
@@ -1,12 +1,30 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <new>
 #include <regex>
+#include <set>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 using namespace std;
 
 #include <qpdf/QPDF.hh>
+#include <qpdf/QPDFAnnotationObjectHelper.hh>
+#include <qpdf/QPDFEmbeddedFileDocumentHelper.hh>
+#include <qpdf/QPDFFileSpecObjectHelper.hh>
 #include <qpdf/QPDFObjectHandle.hh>
 #include <qpdf/QPDFPageDocumentHelper.hh>
 #include <qpdf/QPDFPageObjectHelper.hh>
@@ -14,188 +32,486 @@ using namespace std;
 #include <qpdf/QPDFWriter.hh>
 #include <qpdf/QUtil.hh>
 
-// Enum representing the scope at which the redaction will take place
-enum scope_t {
-    // Redact only the matching text
-    s_match,
-    // Redact the operator (e.g. Tj) containing the matching text
-    s_operator,
-    // Redact the text object (BT/ET) containing the matching text
-    s_text_object,
-    // Redact the graphics state block (q/Q) containing the matching text
-    s_graphics_state,
-    // Redact the content stream containing the matching text
-    s_stream,
-    // Redact the page containing the matching text
-    s_page
-};
+#include "filter.hh"
 
-// Argument flags used to set scope; index matches enum
-const string SCOPE_FLAGS = "motqsp";
+#ifdef COUNT_ALLOCATIONS
+// Total bytes allocated through the global operator new, and the largest single
+// allocation; counting is only compiled in when requested (e.g. for debugging
+// or benchmarking), since it adds to the cost of every allocation
+size_t allocated = 0, largest = 0;
 
-// Shorthand for which scopes contain start/end operators, and so can be nested
-inline bool nestable(scope_t scope) {
-    return scope == s_text_object || scope == s_graphics_state;
+void *operator new(size_t size) {
+    allocated += size;
+    largest = max(largest, size);
+    if (auto ptr = malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw bad_alloc();
 }
 
+void operator delete(void *ptr) noexcept { free(ptr); }
+
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+#endif
+
 // Struct to hold the command-line arguments
 struct args_t {
-    const char *whoami, *regex, *infile, *outfile;
+    const char *whoami, *regex, *rulefile, *infile, *outfile, *batch;
+    const char *trace, *metrics;
     scope_t scope;
+    bool stats, profile, verify, invisible;
+
+    // Names of the optional content groups (layers) to remove
+    set<string> layers;
+
+    // File descriptor to report progress to, or 0 if not reporting
+    int progress;
+
+    // Rules compiled from the regex or rule file
+    vector<rule_t> rules;
+};
+
+// Struct to hold the state of redacting a single document
+struct document_t {
+    // Whether redacting each shared object (e.g. an appearance stream, form
+    // field or action) required redacting its page, so that each is only
+    // redacted once per document
+    map<QPDFObjGen, bool> redacted;
 };
 
 // Print usage and exit
 void usage(args_t &args) {
     cerr << "Usage: " << args.whoami << " [-" << SCOPE_FLAGS << "] "
-         << "regex infile [outfile]" << endl;
+         << "[--invisible] [--verify] [--stats] [--trace file] "
+         << "[--metrics file] [--progress | --progress-fd fd] "
+         << "[--remove-ocg name]... "
+         << "{regex | --rules file} {infile [outfile] | --batch list}"
+         << endl;
+    cerr << "       " << args.whoami << " --profile-doc infile" << endl;
     exit(2);
 }
 
 // Parse command-line arguments
 void parseArgs(int argc, char *argv[], args_t &args) {
     args.whoami = QUtil::getWhoami(argv[0]);
+    vector<const char *> positional;
     for (auto i = 1; i < argc; i++) {
-        if (argv[i][0] == '-') {
+        if (string(argv[i]) == "--stats") {
+            args.stats = true;
+        } else if (string(argv[i]) == "--invisible") {
+            args.invisible = true;
+        } else if (string(argv[i]) == "--verify") {
+            args.verify = true;
+        } else if (string(argv[i]) == "--profile-doc") {
+            args.profile = true;
+        } else if (string(argv[i]) == "--trace" && i + 1 < argc) {
+            args.trace = argv[++i];
+        } else if (string(argv[i]) == "--batch" && i + 1 < argc) {
+            args.batch = argv[++i];
+        } else if (string(argv[i]) == "--metrics" && i + 1 < argc) {
+            args.metrics = argv[++i];
+        } else if (string(argv[i]) == "--progress") {
+            args.progress = STDERR_FILENO;
+        } else if (string(argv[i]) == "--progress-fd" && i + 1 < argc) {
+            args.progress = atoi(argv[++i]);
+            if (args.progress <= 0) {
+                usage(args);
+            }
+        } else if (string(argv[i]) == "--remove-ocg" && i + 1 < argc) {
+            args.layers.insert(argv[++i]);
+        } else if (string(argv[i]) == "--rules" && i + 1 < argc) {
+            args.rulefile = argv[++i];
+        } else if (argv[i][0] == '-') {
             args.scope = (scope_t)(SCOPE_FLAGS.find(argv[i][1]));
             if (args.scope == string::npos) {
                 usage(args);
             }
-        } else if (!args.regex) {
-            args.regex = argv[i];
-        } else if (!args.infile) {
-            args.infile = argv[i];
-        } else if (!args.outfile) {
-            args.outfile = argv[i];
         } else {
-            usage(args);
+            positional.push_back(argv[i]);
         }
     }
-    if (!args.regex || !args.infile) {
+
+    // The regex is omitted if the rules are read from a file, and both it and
+    // the outfile are omitted when only profiling the document; the files are
+    // omitted entirely in batch mode
+    auto next = positional.begin(), end = positional.end();
+    if (!args.rulefile && !args.profile && next != end) {
+        args.regex = *next++;
+    }
+    if (!args.batch && next != end) {
+        args.infile = *next++;
+    }
+    if (!args.batch && !args.profile && next != end) {
+        args.outfile = *next++;
+    }
+    if (next != end || !(args.infile || args.batch) ||
+        !(args.regex || args.rulefile || args.profile) ||
+        (args.batch && args.profile)) {
         usage(args);
     }
 }
 
-// Class implementing a token filter to identify and remove matches at the
-// specified scope; it will handle filtering within the stream and flag
-// matches for redaction at a higher scope
-class Filter : public QPDFObjectHandle::TokenFilter {
-    regex _regex;
-    scope_t _scope;
-    bool _redact = false;
-    bool _trim = false;
-
-    // Each frame of the stack contains the unwritten raw data (which is being
-    // stored in case it needs to be redacted in the future), and the collected
-    // text to test for redaction
-    vector<pair<string, string>> _stack;
+// Compile the rules from the regex or rule file (one regex per line, ignoring
+// blank lines); rules only apply to invisible text if given the option, or
+// prefixed with "invisible" and a tab
+void compileRules(args_t &args) {
+    vector<string> patterns;
+    if (args.regex) {
+        patterns.push_back(args.regex);
+    } else {
+        for (auto &line : QUtil::read_lines_from_file(args.rulefile)) {
+            if (!line.empty()) {
+                patterns.push_back(line);
+            }
+        }
+    }
+    for (auto &pattern : patterns) {
+        auto invisible = args.invisible;
+        if (pattern.compare(0, 10, "invisible\t") == 0) {
+            pattern.erase(0, 10);
+            invisible = true;
+        }
+        args.rules.push_back({pattern, regex(pattern), invisible});
+    }
+}
 
-    // Add a token to the currently active frame
-    void _add(const QPDFTokenizer::Token &token) {
-        auto &frame = _stack.back();
-        frame.first += token.getRawValue();
-        if (token.getType() == QPDFTokenizer::tt_string) {
-            frame.second += token.getValue();
+// Quote a string for inclusion in JSON output
+string jsonString(const string &str) {
+    string quoted = "\"";
+    for (unsigned char c : str) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += c;
+        } else if (c < 0x20) {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", c);
+            quoted += escape;
+        } else {
+            quoted += c;
         }
-        _trim = false;
     }
+    return quoted + "\"";
+}
 
-    // Flush the currently active frame to the next lower frame
-    void _flush() {
-        auto frame = _stack.back();
-        _stack.pop_back();
+// Class accumulating the time spent (and bytes allocated, if counted) in a
+// phase over its lifetime
+class Timer {
+    stats_t &_stats;
+    phase_t _phase;
+    chrono::steady_clock::time_point _wall = chrono::steady_clock::now();
+    clock_t _cpu = clock();
+#ifdef COUNT_ALLOCATIONS
+    size_t _allocated = allocated;
+#endif
 
-        // The frame is removed either way, but the data is only added if
-        // it is not being redacted
-        if (!regex_search(frame.second, _regex)) {
-            auto &top = _stack.back();
-            top.first += frame.first;
-            top.second += frame.second;
-        } else {
-            // Since the filter is operating on a stream, flag the immediate
-            // next whitespace as also requiring redaction
-            _redact = _trim = true;
+  public:
+    Timer(stats_t &stats, phase_t phase) : _stats(stats), _phase(phase) {}
+
+    ~Timer() {
+        chrono::duration<double> wall = chrono::steady_clock::now() - _wall;
+        _stats.time[_phase].first += wall.count();
+        _stats.time[_phase].second += double(clock() - _cpu) / CLOCKS_PER_SEC;
+#ifdef COUNT_ALLOCATIONS
+        _stats.allocated[_phase] += allocated - _allocated;
+#endif
+    }
+};
+
+// Get the peak resident set size of the process, in bytes
+long peakRSS() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return usage.ru_maxrss * 1024;
+#endif
+}
+
+// Number of the slowest pages and streams to report
+const size_t SLOWEST = 10;
+
+// Keep a profile if it is among the slowest seen so far
+void keepSlowest(vector<profile_t> &slowest, const profile_t &profile) {
+    auto slower = [](const profile_t &a, const profile_t &b) {
+        return a.time > b.time;
+    };
+    if (slowest.size() < SLOWEST) {
+        slowest.push_back(profile);
+        push_heap(slowest.begin(), slowest.end(), slower);
+    } else if (profile.time > slowest.front().time) {
+        pop_heap(slowest.begin(), slowest.end(), slower);
+        slowest.back() = profile;
+        push_heap(slowest.begin(), slowest.end(), slower);
+    }
+}
+
+// Add the profile of a stream to that of the page containing it
+void mergeProfile(profile_t &page, const profile_t &stream) {
+    page.streams += stream.streams;
+    page.bytes += stream.bytes;
+    page.tokens += stream.tokens;
+    page.depth = max(page.depth, stream.depth);
+    for (auto i = 0; i < 8; i++) {
+        page.operators[i] += stream.operators[i];
+    }
+    page.regex_time += stream.regex_time;
+}
+
+// Record the time spent redacting the current page
+void recordPage(stats_t &stats, double time) {
+    auto bucket = 0;
+    while (bucket < 13 && time > PAGE_BUCKETS[bucket]) {
+        bucket++;
+    }
+    stats.page_buckets[bucket]++;
+    stats.page_seconds += time;
+    stats.page.time = time;
+    keepSlowest(stats.slowest_pages, stats.page);
+}
+
+// Get the number of matches redacted at any scope
+size_t totalMatches(stats_t &stats) {
+    size_t matches = 0;
+    for (auto count : stats.matches) {
+        matches += count;
+    }
+    return matches;
+}
+
+// Print the slowest profiles as a JSON array, slowest first
+void printSlowest(ostream &out, vector<profile_t> slowest) {
+    sort_heap(slowest.begin(), slowest.end(),
+              [](const profile_t &a, const profile_t &b) {
+                  return a.time > b.time;
+              });
+    out << "[";
+    for (auto i = size_t(0); i < slowest.size(); i++) {
+        auto &profile = slowest[i];
+        out << (i ? "," : "") << "\n    {\"page\": " << profile.page + 1
+            << ", \"object\": " << profile.object
+            << ", \"time\": " << profile.time
+            << ", \"regex_time\": " << profile.regex_time
+            << ", \"streams\": " << profile.streams
+            << ", \"bytes\": " << profile.bytes
+            << ", \"tokens\": " << profile.tokens
+            << ", \"depth\": " << profile.depth << ", \"operators\": {";
+        for (auto j = 0; j < 8; j++) {
+            out << (j ? ", " : "") << "\"" << OP_CLASS_NAMES[j]
+                << "\": " << profile.operators[j];
         }
+        out << "}}";
+    }
+    out << "\n  ]";
+}
+
+// Print the collected statistics as JSON, with rules sorted by the time spent
+// matching them
+void printStats(ostream &out, args_t &args, stats_t &stats) {
+    out << "{\n  \"phases\": {";
+    for (auto i = 0; i < 4; i++) {
+        out << (i ? "," : "") << "\n    \"" << PHASE_NAMES[i] << "\": "
+            << "{\"wall\": " << stats.time[i].first
+            << ", \"cpu\": " << stats.time[i].second;
+#ifdef COUNT_ALLOCATIONS
+        out << ", \"allocated\": " << stats.allocated[i];
+#endif
+        out << "}";
+    }
+    out << "\n  },\n  \"memory\": {\"peak_rss\": " << peakRSS();
+#ifdef COUNT_ALLOCATIONS
+    out << ", \"largest_allocation\": " << largest;
+#endif
+    out << "},\n  \"bytes\": {\"decoded\": " << stats.decoded
+        << ", \"encoded\": " << stats.encoded << "},\n  \"tokens\": "
+        << stats.tokens << ",\n  \"frames\": " << stats.frames
+        << ",\n  \"layers\": " << stats.layers << ",\n  \"matches\": {";
+    for (auto i = 0; i < 6; i++) {
+        out << (i ? ", " : "") << "\"" << SCOPE_NAMES[i]
+            << "\": " << stats.matches[i];
+    }
+    out << "},\n  \"pages\": {\"touched\": " << stats.pages_touched
+        << ", \"skipped\": " << stats.pages_skipped
+        << ", \"removed\": " << stats.pages_removed
+        << "},\n  \"streams\": {\"touched\": " << stats.streams_touched
+        << ", \"skipped\": " << stats.streams_skipped << "},\n  \"rules\": [";
+    vector<rule_t *> rules;
+    for (auto &rule : args.rules) {
+        rules.push_back(&rule);
     }
+    stable_sort(rules.begin(), rules.end(),
+                [](rule_t *a, rule_t *b) { return a->time > b->time; });
+    for (auto i = size_t(0); i < rules.size(); i++) {
+        out << (i ? "," : "") << "\n    {\"pattern\": "
+            << jsonString(rules[i]->pattern) << ", \"invisible\": "
+            << (rules[i]->invisible ? "true" : "false")
+            << ", \"evaluations\": " << rules[i]->evaluations
+            << ", \"matches\": " << rules[i]->matches
+            << ", \"time\": " << rules[i]->time << "}";
+    }
+    out << "\n  ],\n  \"slowest_pages\": ";
+    printSlowest(out, stats.slowest_pages);
+    out << ",\n  \"slowest_streams\": ";
+    printSlowest(out, stats.slowest_streams);
+    out << "\n}" << endl;
+}
 
-    // Start a new frame if the desired scope matches the expected scope,
-    // and add the given token at the beginning
-    void _start(scope_t scope, const QPDFTokenizer::Token &token) {
-        // Start a new frame only if there is none or the scope is nestable
-        if (_scope == scope && (nestable(scope) || _stack.size() == 1)) {
-            _stack.push_back({});
+// Write the collected statistics as metrics in Prometheus text format, along
+// with the outcome of the run; the file is replaced atomically, so that it can
+// be scraped (e.g. by the node exporter's textfile collector) at any time
+void writeMetrics(args_t &args, stats_t &stats) {
+    auto tmpfile = string(args.metrics) + "~";
+    ofstream out(tmpfile);
+    out << "# TYPE redact_pdf_documents_total counter\n"
+        << "redact_pdf_documents_total{outcome=\"ok\"} " << stats.documents_ok
+        << "\nredact_pdf_documents_total{outcome=\"error\"} "
+        << stats.documents_failed << "\n"
+        << "# TYPE redact_pdf_phase_seconds_total counter\n";
+    for (auto i = 0; i < 4; i++) {
+        out << "redact_pdf_phase_seconds_total{phase=\"" << PHASE_NAMES[i]
+            << "\",clock=\"wall\"} " << stats.time[i].first << "\n"
+            << "redact_pdf_phase_seconds_total{phase=\"" << PHASE_NAMES[i]
+            << "\",clock=\"cpu\"} " << stats.time[i].second << "\n";
+    }
+    out << "# TYPE redact_pdf_page_seconds histogram\n";
+    size_t count = 0;
+    for (auto i = 0; i < 14; i++) {
+        count += stats.page_buckets[i];
+        out << "redact_pdf_page_seconds_bucket{le=\"";
+        if (i < 13) {
+            out << PAGE_BUCKETS[i];
+        } else {
+            out << "+Inf";
         }
-        _add(token);
+        out << "\"} " << count << "\n";
     }
+    out << "redact_pdf_page_seconds_sum " << stats.page_seconds << "\n"
+        << "redact_pdf_page_seconds_count " << count << "\n"
+        << "# TYPE redact_pdf_pages_total counter\n"
+        << "redact_pdf_pages_total{state=\"touched\"} " << stats.pages_touched
+        << "\nredact_pdf_pages_total{state=\"skipped\"} "
+        << stats.pages_skipped
+        << "\nredact_pdf_pages_total{state=\"removed\"} "
+        << stats.pages_removed << "\n"
+        << "# TYPE redact_pdf_streams_total counter\n"
+        << "redact_pdf_streams_total{state=\"touched\"} "
+        << stats.streams_touched
+        << "\nredact_pdf_streams_total{state=\"skipped\"} "
+        << stats.streams_skipped << "\n"
+        << "# TYPE redact_pdf_matches_total counter\n";
+    for (auto i = 0; i < 6; i++) {
+        out << "redact_pdf_matches_total{scope=\"" << SCOPE_NAMES[i] << "\"} "
+            << stats.matches[i] << "\n";
+    }
+    out << "# TYPE redact_pdf_bytes_total counter\n"
+        << "redact_pdf_bytes_total{direction=\"decoded\"} " << stats.decoded
+        << "\nredact_pdf_bytes_total{direction=\"encoded\"} "
+        << stats.encoded << "\n"
+        << "# TYPE redact_pdf_tokens_total counter\n"
+        << "redact_pdf_tokens_total " << stats.tokens << "\n"
+        << "# TYPE redact_pdf_peak_rss_bytes gauge\n"
+        << "redact_pdf_peak_rss_bytes " << peakRSS() << endl;
+    out.close();
+    if (!out || rename(tmpfile.c_str(), args.metrics)) {
+        cerr << args.whoami << ": unable to write " << args.metrics << endl;
+    }
+}
+
+// Class reporting progress through the pages of a document to a file
+// descriptor, at most once per second so as not to slow the page loop
+class Progress {
+    int _fd;
+    size_t _total;
+    chrono::steady_clock::time_point _start = chrono::steady_clock::now();
+    chrono::steady_clock::time_point _next = _start;
 
-    // Add the given token and flush the current frame if the desired scope
-    // matches the expected scope
-    void _end(scope_t scope, const QPDFTokenizer::Token &token) {
-        _add(token);
-        if (_scope == scope && _stack.size() > 1) {
-            _flush();
+  public:
+    Progress(int fd, size_t total) : _fd(fd), _total(total) {}
+
+    // Report the number of pages done, unless reported too recently; the
+    // final page is always reported
+    void update(size_t done, stats_t &stats) {
+        auto now = chrono::steady_clock::now();
+        if (!_fd || (now < _next && done < _total)) {
+            return;
         }
+        _next = now + chrono::seconds(1);
+
+        auto matches = totalMatches(stats);
+        chrono::duration<double> elapsed = now - _start;
+        auto eta = long(elapsed.count() / done * (_total - done));
+        dprintf(_fd,
+                "pages %zu/%zu, %.1f MB, %zu matches, ETA %ld:%02ld:%02ld\n",
+                done, _total, stats.decoded / 1e6, matches, eta / 3600,
+                eta / 60 % 60, eta % 60);
     }
+};
+
+// Class recording begin/end events in Chrome trace-event format; recording is
+// skipped entirely unless a trace file has been requested
+class Trace {
+    const char *_file = nullptr;
+    chrono::steady_clock::time_point _start = chrono::steady_clock::now();
+    string _events;
 
   public:
-    Filter(const char *regex, scope_t scope) : _regex(regex), _scope(scope) {
-        _stack.push_back({});
+    void open(const char *file) { _file = file; }
+
+    bool enabled() { return _file; }
+
+    // Record an event of the given phase ('B' or 'E'), with an optional
+    // numeric argument
+    void event(char phase, const char *name, const char *key, long long value) {
+        chrono::duration<double, micro> ts =
+            chrono::steady_clock::now() - _start;
+        auto pid = to_string(getpid());
+        _events += string(_events.empty() ? "\n" : ",\n") + "{\"name\": \"" +
+                   name + "\", \"ph\": \"" + phase +
+                   "\", \"ts\": " + to_string(ts.count()) +
+                   ", \"pid\": " + pid + ", \"tid\": " + pid;
+        if (key) {
+            _events += ", \"args\": {\"" + string(key) +
+                       "\": " + to_string(value) + "}";
+        }
+        _events += "}";
     }
 
-    void handleToken(const QPDFTokenizer::Token &token) {
-        auto &value = token.getValue();
-        switch (token.getType()) {
-        case QPDFTokenizer::tt_word:
-            // Mark appropriate start/end operators (which have no arguments) or
-            // the end of an operator block (which may have arguments)
-            if (value == "BT") {
-                _start(s_text_object, token);
-            } else if (value == "ET") {
-                _end(s_text_object, token);
-            } else if (value == "q") {
-                _start(s_graphics_state, token);
-            } else if (value == "Q") {
-                _end(s_graphics_state, token);
-            } else {
-                _end(s_operator, token);
+    // Write the recorded events to the trace file
+    // Save the events to the file, only once (i.e. not again if that failed)
+    void write() {
+        if (_file) {
+            auto file = _file;
+            _file = nullptr;
+            ofstream out(file);
+            out << "{\"traceEvents\": [" << _events << "\n]}" << endl;
+            if (!out) {
+                throw runtime_error(string("unable to write ") + file);
             }
-            break;
-        case QPDFTokenizer::tt_space:
-            // Add the space token if it should not be trimmed immediately
-            // following a redaction, then unmark the trimming state
-            if (!_trim) {
-                _add(token);
-            }
-            _trim = false;
-            break;
-        case QPDFTokenizer::tt_string:
-            if (_scope == s_match) {
-                // For match-scoped redactions, simply replace any matches with
-                // an empty string and replace the string token with the result
-                auto redacted = regex_replace(value, _regex, "");
-                _add(QPDFTokenizer::Token(QPDFTokenizer::tt_string, redacted));
-                break;
-            }
-        default:
-            // Any other token may be an argument that needs to be trimmed as
-            // part of redacting an operator; since operators can't be nested,
-            // marking this repeatedly is safe
-            _start(s_operator, token);
-            break;
         }
     }
+};
+
+// Global trace, so that spans can be recorded anywhere without threading it
+// through every call
+Trace trace;
 
-    void handleEOF() {
-        // Flush any remaining open frames
-        while (_stack.size() > 1) {
-            _flush();
+// Class recording a span in the global trace over its lifetime
+class Span {
+    const char *_name;
+
+  public:
+    Span(const char *name, const char *key = nullptr, long long value = 0)
+        : _name(name) {
+        if (trace.enabled()) {
+            trace.event('B', name, key, value);
         }
     }
 
-    // Get final raw stream data
-    const string &data() { return _stack[0].first; }
-
-    // Test final text for redaction
-    bool redact() { return _redact || regex_search(_stack[0].second, _regex); }
+    ~Span() {
+        if (trace.enabled()) {
+            trace.event('E', _name, nullptr, 0);
+        }
+    }
 };
 
 // Get the contents of a page or form XObject
@@ -207,91 +523,1617 @@ vector<QPDFObjectHandle> getContents(QPDFObjectHandle &obj) {
     }
 }
 
-// Set the contents of a page (no-op for a form XObject)
+// Set the contents of a page, or of a content stream (e.g. a form XObject),
+// emptying it if its contents were omitted
 void setContents(QPDFObjectHandle &obj, vector<QPDFObjectHandle> &c) {
     if (obj.isPageObject()) {
         obj.replaceKey("/Contents",
                        c.size() == 1 ? c[0] : QPDFObjectHandle::newArray(c));
+    } else if (c.empty()) {
+        obj.replaceStreamData("", QPDFObjectHandle::newNull(),
+                              QPDFObjectHandle::newNull());
     }
-    // TODO: Figure out what stream-level filters for form XObjects should mean
 }
 
-// Redact the contents of a page; return whether to redact the entire page
-bool redactPage(args_t &args, QPDFPageObjectHelper &page) {
+// Get the resources of a page, or of a content stream (e.g. a form XObject)
+QPDFObjectHandle getResources(QPDFPageObjectHelper &page) {
     auto object = page.getObjectHandle();
+    return object.isStream() ? object.getDict().getKey("/Resources")
+                             : page.getAttribute("/Resources", false);
+}
 
-    // Loop through each page contents, testing for matches
-    vector<QPDFObjectHandle> contents;
+// Get the streams of a dictionary of resources (e.g. /XObject), optionally
+// only those of the given subtype
+vector<QPDFObjectHandle> getStreams(QPDFObjectHandle dict,
+                                    const string &subtype = "") {
+    vector<QPDFObjectHandle> streams;
+    if (!dict.isDictionary()) {
+        return streams;
+    }
+    for (auto &entry : dict.getDictAsMap()) {
+        auto &stream = entry.second;
+        if (stream.isStream() &&
+            (subtype.empty() ||
+             stream.getDict().getKey("/Subtype").isNameAndEquals(subtype))) {
+            streams.push_back(stream);
+        }
+    }
+    return streams;
+}
+
+// Get the appearance streams of an annotation, for every type and state
+vector<QPDFObjectHandle> getAppearances(QPDFObjectHandle annot) {
+    vector<QPDFObjectHandle> streams;
+    auto appearances = annot.getKey("/AP");
+    if (!appearances.isDictionary()) {
+        return streams;
+    }
+    for (auto type : {"/N", "/R", "/D"}) {
+        auto value = appearances.getKey(type);
+        if (value.isStream()) {
+            streams.push_back(value);
+        } else if (value.isDictionary()) {
+            for (auto &state : value.getDictAsMap()) {
+                if (state.second.isStream()) {
+                    streams.push_back(state.second);
+                }
+            }
+        }
+    }
+    return streams;
+}
+
+// Find the content streams among resources that are redacted along with them:
+// form XObjects, tiling patterns and the glyph procedures of Type3 fonts, along
+// with those among the resources of each font (which, as when redacting, are
+// skipped for direct fonts, and only visited once for the others)
+void findStreams(QPDFObjectHandle resources, vector<QPDFObjectHandle> &streams,
+                 set<QPDFObjGen> &fonts) {
+    if (!resources.isDictionary()) {
+        return;
+    }
+    for (auto &stream : getStreams(resources.getKey("/XObject"), "/Form")) {
+        streams.push_back(stream);
+    }
+    for (auto &stream : getStreams(resources.getKey("/Pattern"))) {
+        streams.push_back(stream);
+    }
+    auto dict = resources.getKey("/Font");
+    if (!dict.isDictionary()) {
+        return;
+    }
+    for (auto &entry : dict.getDictAsMap()) {
+        auto &font = entry.second;
+        if (!font.isDictionaryOfType("/Font", "/Type3") ||
+            (font.isIndirect() && !fonts.insert(font.getObjGen()).second)) {
+            continue;
+        }
+        for (auto &stream : getStreams(font.getKey("/CharProcs"))) {
+            streams.push_back(stream);
+        }
+        if (font.isIndirect()) {
+            findStreams(font.getKey("/Resources"), streams, fonts);
+        }
+    }
+}
+
+// Class implementing a token filter which profiles content streams without
+// modifying them, using the same tokenizer as the redaction filter
+class Profiler : public QPDFObjectHandle::TokenFilter {
+    size_t _q = 0, _bt = 0;
+
+  public:
+    // Occurrences of each operator
+    map<string, size_t> operators;
+
+    // Bytes within text objects and outside of them (i.e. graphics)
+    size_t text = 0, graphics = 0;
+
+    // Maximum nesting depth of graphics states and text objects
+    size_t max_q = 0, max_bt = 0;
+
+    // Number of streams, their total and largest sizes (both encoded and
+    // decoded), and the number using each encoding
+    size_t streams = 0, encoded = 0, decoded = 0, largest = 0;
+    map<string, size_t> encodings;
+
+    void handleToken(const QPDFTokenizer::Token &token) {
+        auto &value = token.getValue();
+        auto word = token.getType() == QPDFTokenizer::tt_word;
+        if (word) {
+            operators[value]++;
+            if (value == "q") {
+                max_q = max(max_q, ++_q);
+            } else if (value == "Q") {
+                _q -= _q > 0;
+            } else if (value == "BT") {
+                max_bt = max(max_bt, ++_bt);
+            }
+        }
+        (_bt ? text : graphics) += token.getRawValue().size();
+        if (word && value == "ET") {
+            _bt -= _bt > 0;
+        }
+    }
+
+    void handleEOF() { _q = _bt = 0; }
+
+    // Profile a single content stream
+    void profile(QPDFObjectHandle &stream) {
+        auto dict = stream.getDict();
+        auto filter = dict.getKey("/Filter");
+        string encoding = "none";
+        if (filter.isName()) {
+            encoding = filter.getName();
+        } else if (filter.isArray()) {
+            encoding.clear();
+            for (auto &item : filter.getArrayAsVector()) {
+                encoding += item.isName() ? item.getName() : "?";
+            }
+        }
+        encodings[encoding]++;
+        auto length = dict.getKey("/Length");
+        encoded += length.isInteger() ? length.getIntValue() : 0;
+
+        auto before = text + graphics;
+        stream.filterAsContents(this);
+        decoded += text + graphics - before;
+        largest = max(largest, text + graphics - before);
+        streams++;
+    }
+};
+
+// Profile the contents of a page or content stream, followed by the content
+// streams of its resources (and of a page's annotations), found as when
+// redacting; each is profiled only once, but its references are counted
+void profilePage(QPDFPageObjectHelper page, Profiler &profiler,
+                 map<QPDFObjGen, size_t> &forms, set<QPDFObjGen> &fonts) {
+    auto object = page.getObjectHandle();
     for (auto &obj : getContents(object)) {
-        Filter filter(args.regex, args.scope);
-        obj.filterAsContents(&filter);
-        if (filter.redact()) {
-            switch (args.scope) {
-            case s_page:
-                // For page-scoped redactions, simply bail here
-                return true;
-            case s_stream:
-                // For stream-scoped redactions, omit the stream
+        profiler.profile(obj);
+    }
+    vector<QPDFObjectHandle> streams;
+    findStreams(getResources(page), streams, fonts);
+    if (object.isPageObject()) {
+        for (auto &annot : page.getAnnotations()) {
+            for (auto &stream : getAppearances(annot.getObjectHandle())) {
+                streams.push_back(stream);
+            }
+        }
+    }
+    for (auto &stream : streams) {
+        if (!forms[stream.getObjGen()]++) {
+            profilePage(QPDFPageObjectHelper(stream), profiler, forms, fonts);
+        }
+    }
+}
+
+// Profile every content stream of a document, and print the results as JSON
+void profileDocument(ostream &out, QPDF &pdf) {
+    Profiler profiler;
+    map<QPDFObjGen, size_t> forms;
+    set<QPDFObjGen> fonts;
+    auto pages = QPDFPageDocumentHelper(pdf).getAllPages();
+    for (auto &page : pages) {
+        profilePage(page, profiler, forms, fonts);
+    }
+
+    size_t references = 0, shared = 0;
+    for (auto &entry : forms) {
+        references += entry.second;
+        shared += entry.second > 1;
+    }
+    auto bytes = profiler.text + profiler.graphics;
+    vector<pair<string, size_t>> operators(profiler.operators.begin(),
+                                           profiler.operators.end());
+    stable_sort(operators.begin(), operators.end(),
+                [](const pair<string, size_t> &a,
+                   const pair<string, size_t> &b) {
+                    return a.second > b.second;
+                });
+
+    out << "{\n  \"pages\": " << pages.size()
+        << ",\n  \"streams\": {\"count\": " << profiler.streams
+        << ", \"encoded\": " << profiler.encoded
+        << ", \"decoded\": " << profiler.decoded
+        << ", \"largest\": " << profiler.largest << ", \"encodings\": {";
+    auto first = true;
+    for (auto &entry : profiler.encodings) {
+        out << (first ? "" : ", ") << jsonString(entry.first) << ": "
+            << entry.second;
+        first = false;
+    }
+    out << "}},\n  \"forms\": {\"count\": " << forms.size()
+        << ", \"references\": " << references << ", \"shared\": " << shared
+        << "},\n  \"bytes\": {\"text\": " << profiler.text
+        << ", \"graphics\": " << profiler.graphics << ", \"text_share\": "
+        << (bytes ? double(profiler.text) / bytes : 0)
+        << "},\n  \"depth\": {\"q\": " << profiler.max_q
+        << ", \"BT\": " << profiler.max_bt << "},\n  \"operators\": {";
+    for (auto i = size_t(0); i < operators.size(); i++) {
+        out << (i ? "," : "") << "\n    " << jsonString(operators[i].first)
+            << ": " << operators[i].second;
+    }
+    out << "\n  }\n}" << endl;
+}
+
+// Re-tokenize rewritten stream data (still in memory) with the same rules and
+// scope, throwing if any of it would still be redacted
+void verifyStream(args_t &args, QPDFObjectHandle &obj) {
+    Span span("verify", "object", obj.getObjGen().getObj());
+    // Verify against a copy of the rules, so that their evaluations and time
+    // only count the redaction itself
+    auto rules = args.rules;
+    stats_t stats{};
+    Filter filter(rules, args.scope, stats);
+    obj.filterAsContents(&filter);
+    if (filter.redact()) {
+        auto id = obj.getObjGen().unparse(' ');
+        throw runtime_error("verification failed: matching text remains in "
+                            "object " + id);
+    }
+}
+
+// Redact a text string in place; return whether to redact the entire page
+bool redactText(args_t &args, stats_t &stats, string &text) {
+    auto &time = stats.page.regex_time;
+
+    // For match-scoped redactions, simply remove the matches from the string
+    if (args.scope == s_match) {
+        auto redacted = replaceRules(args.rules, s_match, text, time);
+        if (redacted != text) {
+            stats.matches[s_match]++;
+            text = redacted;
+        }
+        return false;
+    }
+
+    if (!searchRules(args.rules, args.scope, text, time)) {
+        return false;
+    }
+    stats.matches[args.scope]++;
+    if (args.scope == s_page) {
+        return true;
+    }
+
+    // For all other scopes, the string as a whole is the smallest unit that
+    // can be redacted, so blank it
+    text.clear();
+    return false;
+}
+
+// Redact a text string entry of a dictionary (e.g. an annotation's /Contents),
+// or each text string of an array entry; return whether to redact the entire
+// page
+bool redactString(args_t &args, stats_t &stats, QPDFObjectHandle dict,
+                  const string &key) {
+    auto value = dict.getKey(key);
+    if (value.isString()) {
+        auto text = value.getUTF8Value(), redacted = text;
+        if (redactText(args, stats, redacted)) {
+            return true;
+        }
+        if (redacted != text) {
+            dict.replaceKey(key, QPDFObjectHandle::newUnicodeString(redacted));
+        }
+    } else if (value.isArray()) {
+        for (auto i = 0; i < value.getArrayNItems(); i++) {
+            auto item = value.getArrayItem(i);
+            if (!item.isString()) {
                 continue;
-            default:
-                // For all other redactions, update the stream data
-                obj.replaceStreamData(filter.data(),
-                                      QPDFObjectHandle::newNull(),
-                                      QPDFObjectHandle::newNull());
+            }
+            auto text = item.getUTF8Value(), redacted = text;
+            if (redactText(args, stats, redacted)) {
+                return true;
+            }
+            if (redacted != text) {
+                value.setArrayItem(
+                    i, QPDFObjectHandle::newUnicodeString(redacted));
             }
         }
-        contents.push_back(obj);
     }
-    setContents(object, contents);
+    return false;
+}
 
-    // Iterate through nested form XObjects
-    for (auto &entry : page.getFormXObjects()) {
-        QPDFPageObjectHelper form(entry.second);
-        if (redactPage(args, form)) {
+// Keys of a form field holding its value: the value, default value and rich
+// text value (each a text string, or an array of them for list boxes)
+const char *const FIELD_KEYS[] = {"/V", "/DV", "/RV"};
+
+// Redact the value of a form field; return whether to redact the entire page
+bool redactField(args_t &args, stats_t &stats, QPDFObjectHandle field) {
+    for (auto key : FIELD_KEYS) {
+        if (redactString(args, stats, field, key)) {
+            // The field remains in the form even once its page is removed,
+            // so also remove its value
+            for (auto key : FIELD_KEYS) {
+                field.removeKey(key);
+            }
             return true;
         }
     }
+    return false;
+}
 
+// Redact the values of the form field of a widget annotation, along with
+// those of its ancestors (from which they may be inherited), each only once;
+// return whether to redact the entire page
+bool redactFields(args_t &args, stats_t &stats, document_t &doc,
+                  QPDFObjectHandle widget) {
+    for (auto field = widget; field.isDictionary();
+         field = field.getKey("/Parent")) {
+        // Fields already redacted have had their ancestors redacted as well
+        auto found = doc.redacted.find(field.getObjGen());
+        if (field.isIndirect() && found != doc.redacted.end()) {
+            return found->second;
+        }
+        auto redact = redactField(args, stats, field);
+        if (field.isIndirect()) {
+            doc.redacted[field.getObjGen()] = redact;
+        }
+        if (redact) {
+            return true;
+        }
+    }
     return false;
 }
 
-int main(int argc, char *argv[]) {
-    args_t args{};
-    parseArgs(argc, argv, args);
+// Decode XML character data or an attribute value, resolving the predefined
+// entities and character references (anything else is kept as is)
+string decodeXml(const string &xml, size_t begin, size_t end) {
+    static const map<string, char> ENTITIES = {
+        {"amp", '&'}, {"lt", '<'}, {"gt", '>'}, {"quot", '"'}, {"apos", '\''}};
+    string text;
+    text.reserve(end - begin);
+    for (auto i = begin; i < end; i++) {
+        if (xml[i] != '&') {
+            text += xml[i];
+            continue;
+        }
 
-    try {
-        QPDF pdf;
-        pdf.processFile(args.infile);
+        // References are short (e.g. "&#x10FFFF;"), so only look a few
+        // characters ahead for the semicolon ending one
+        auto start = xml.data() + i;
+        auto semi = (const char *)memchr(start, ';', min(end - i, size_t(12)));
+        if (!semi) {
+            text += xml[i];
+            continue;
+        }
+        string name(start + 1, semi);
+        auto found = ENTITIES.find(name);
+        if (found != ENTITIES.end()) {
+            text += found->second;
+        } else if (name.size() > 1 && name[0] == '#') {
+            auto hex = name[1] == 'x';
+            text += QUtil::toUTF8(strtoul(name.c_str() + 1 + hex, nullptr,
+                                          hex ? 16 : 10));
+        } else {
+            text += xml[i];
+            continue;
+        }
+        i = semi - xml.data();
+    }
+    return text;
+}
+
+// Encode text as XML character data or an attribute value
+string encodeXml(const string &text) {
+    string xml;
+    for (auto c : text) {
+        switch (c) {
+        case '&':
+            xml += "&amp;";
+            break;
+        case '<':
+            xml += "&lt;";
+            break;
+        case '>':
+            xml += "&gt;";
+            break;
+        case '"':
+            xml += "&quot;";
+            break;
+        case '\'':
+            xml += "&apos;";
+            break;
+        default:
+            xml += c;
+        }
+    }
+    return xml;
+}
+
+// Redact a run of XML text (encoded, unless in a CDATA section), appending it
+// to the output; return whether to redact the entire page. Without a page
+// (e.g. form data), text that would redact the page is blanked instead
+bool redactXmlText(args_t &args, stats_t &stats, const string &xml,
+                   size_t begin, size_t end, bool encoded, string &out,
+                   bool page) {
+    // Most runs are simply whitespace between elements
+    if (xml.find_first_not_of(" \t\r\n", begin) >= end) {
+        out.append(xml, begin, end - begin);
+        return false;
+    }
+    // Each redaction of the text is counted as a match, so there's no need to
+    // keep the original to tell whether it changed
+    auto text = encoded ? decodeXml(xml, begin, end)
+                        : xml.substr(begin, end - begin);
+    auto matches = totalMatches(stats);
+    if (redactText(args, stats, text)) {
+        if (page) {
+            return true;
+        }
+        text.clear();
+    }
+    if (totalMatches(stats) == matches) {
+        out.append(xml, begin, end - begin);
+    } else {
+        out += encoded ? encodeXml(text) : text;
+    }
+    return false;
+}
+
+// Test whether the value of an attribute (given the start of its tag and its
+// opening quote) is part of the markup rather than data: a namespace
+// declaration (xmlns or xmlns:*) or an xml:* attribute, e.g. xml:lang
+bool isXmlMarkup(const string &xml, size_t tag, size_t quote) {
+    const char *const SPACE = " \t\r\n";
+    auto equals = xml.find_last_not_of(SPACE, quote - 1);
+    if (equals <= tag || xml[equals] != '=') {
+        return false;
+    }
+    auto end = xml.find_last_not_of(SPACE, equals - 1) + 1;
+    auto begin = xml.find_last_of(SPACE, end - 1);
+    begin = begin == string::npos || begin < tag ? tag + 1 : begin + 1;
+    string name(xml, begin, end - begin);
+    return name == "xmlns" || name.compare(0, 6, "xmlns:") == 0 ||
+           name.compare(0, 4, "xml:") == 0;
+}
 
-        // Loop through each page, redacting as necessary
-        QPDFPageDocumentHelper doc(pdf);
-        for (auto &page : doc.getAllPages()) {
-            if (redactPage(args, page)) {
-                doc.removePage(page);
+// Redact the text (character data and, if requested, attribute values other
+// than those of namespace declarations and xml:* attributes) of an XML
+// document, from the given position up to the limit, appending it to the
+// output; it's scanned in a single pass without building a tree, copying the
+// markup through as is. Return whether to redact the entire page
+bool redactXml(args_t &args, stats_t &stats, const string &xml, size_t pos,
+               size_t limit, string &out, bool page = true,
+               bool attributes = true) {
+    out.reserve(out.size() + limit - pos);
+    while (pos < limit) {
+        if (xml[pos] != '<') {
+            // Character data, up to the next markup
+            auto end = min(xml.find('<', pos), limit);
+            if (redactXmlText(args, stats, xml, pos, end, true, out, page)) {
+                return true;
+            }
+            pos = end;
+        } else if (xml.compare(pos, 9, "<![CDATA[") == 0) {
+            auto end = min(xml.find("]]>", pos), limit);
+            out += "<![CDATA[";
+            if (redactXmlText(args, stats, xml, pos + 9, end, false, out,
+                              page)) {
+                return true;
+            }
+            out += "]]>";
+            pos = end + 3;
+        } else if (xml.compare(pos, 2, "<!") == 0 ||
+                   xml.compare(pos, 2, "<?") == 0) {
+            // Copy comments, processing instructions (e.g. the XMP packet
+            // header) and declarations whole
+            auto close = xml.compare(pos, 4, "<!--") == 0 ? "-->"
+                         : xml[pos + 1] == '?'            ? "?>"
+                                                          : ">";
+            auto end = min(xml.find(close, pos), limit);
+            end = min(end + strlen(close), limit);
+            out.append(xml, pos, end - pos);
+            pos = end;
+        } else {
+            // Copy the tag, redacting the value of each attribute
+            auto end = pos;
+            while (end < limit && xml[end] != '>') {
+                auto quote = xml[end];
+                if (quote != '"' && quote != '\'') {
+                    end++;
+                    continue;
+                }
+                auto close = min(xml.find(quote, end + 1), limit);
+                if (!attributes || isXmlMarkup(xml, pos, end)) {
+                    end = close + 1;
+                    continue;
+                }
+                out.append(xml, pos, end + 1 - pos);
+                if (redactXmlText(args, stats, xml, end + 1, close, true,
+                                  out, page)) {
+                    return true;
+                }
+                pos = close;
+                end = close + 1;
             }
+            end = min(end + 1, limit);
+            out.append(xml, pos, end - pos);
+            pos = end;
         }
+    }
+    return false;
+}
 
-        // Remove any resources (e.g. fonts) that are no longer used once the
-        // desired text has been redacted
-        doc.removeUnreferencedResources();
+// Redact the XMP metadata stream of an object (e.g. a page); return whether to
+// redact the entire page
+bool redactXmp(args_t &args, stats_t &stats, QPDFObjectHandle object) {
+    auto metadata = object.getKey("/Metadata");
+    if (!metadata.isStream()) {
+        return false;
+    }
+    Span span("xmp", "object", metadata.getObjGen().getObj());
+    auto data = metadata.getStreamData();
+    string xml((char *)data->getBuffer(), data->getSize()), redacted;
+    auto matches = totalMatches(stats);
+    if (redactXml(args, stats, xml, 0, xml.size(), redacted)) {
+        return true;
+    }
+    if (totalMatches(stats) != matches) {
+        metadata.replaceStreamData(redacted, QPDFObjectHandle::newNull(),
+                                   QPDFObjectHandle::newNull());
+    }
+    return false;
+}
 
-        // If no outfile was provided (indicating an in-place edit), generate
-        // a temporary file based on the infile
-        auto outfile = args.outfile ? args.outfile : string(args.infile) + "~";
+// Redact a rich text string entry of a dictionary (XHTML, e.g. an annotation's
+// /RC), matching only its character data so that the markup (e.g. styles) is
+// kept as is; return whether to redact the entire page
+bool redactRichText(args_t &args, stats_t &stats, QPDFObjectHandle dict,
+                    const string &key) {
+    auto value = dict.getKey(key);
+    if (!value.isString()) {
+        return false;
+    }
+    auto xml = value.getUTF8Value();
+    string redacted;
+    auto matches = totalMatches(stats);
+    if (redactXml(args, stats, xml, 0, xml.size(), redacted, true, false)) {
+        return true;
+    }
+    if (totalMatches(stats) != matches) {
+        dict.replaceKey(key, QPDFObjectHandle::newUnicodeString(redacted));
+    }
+    return false;
+}
 
-        QPDFWriter writer(pdf, outfile.c_str());
-        writer.write();
+// Redact the metadata of a document: its document information dictionary and
+// XMP metadata. As there is no page to redact, entries that would require
+// redacting a page are removed instead
+void redactMetadata(args_t &args, stats_t &stats, QPDF &pdf) {
+    auto info = pdf.getTrailer().getKey("/Info");
+    if (info.isDictionary()) {
+        for (auto &key : info.getKeys()) {
+            if (redactString(args, stats, info, key)) {
+                info.removeKey(key);
+            }
+        }
+    }
+    auto root = pdf.getRoot();
+    if (redactXmp(args, stats, root)) {
+        root.removeKey("/Metadata");
+    }
+}
 
-        if (!args.outfile) {
-            // Replace the infile with the temporary file
-            pdf.closeInputSource();
-            QUtil::remove_file(args.infile);
-            QUtil::rename_file(outfile.c_str(), args.infile);
+// Redact the alternate text of the property lists (used by marked content)
+// among the resources of a page or content stream; return whether to redact
+// the entire page
+bool redactProperties(args_t &args, stats_t &stats,
+                      QPDFObjectHandle resources) {
+    auto properties = resources.isDictionary()
+                          ? resources.getKey("/Properties")
+                          : QPDFObjectHandle::newNull();
+    if (!properties.isDictionary()) {
+        return false;
+    }
+    for (auto &entry : properties.getDictAsMap()) {
+        if (!entry.second.isDictionary()) {
+            continue;
         }
-    } catch (exception &e) {
-        cerr << args.whoami << ": " << e.what() << endl;
-        exit(2);
+        for (auto key : ALTERNATE_KEYS) {
+            if (redactString(args, stats, entry.second, key)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Redact the alternate text of the structure elements of a structure tree;
+// as the tree belongs to no page, entries that would require redacting a page
+// are removed instead
+void redactStructure(args_t &args, stats_t &stats, QPDFObjectHandle element,
+                     set<QPDFObjGen> &seen) {
+    if (element.isArray()) {
+        for (auto &item : element.getArrayAsVector()) {
+            redactStructure(args, stats, item, seen);
+        }
+        return;
+    }
+    if (!element.isDictionary() ||
+        (element.isIndirect() && !seen.insert(element.getObjGen()).second)) {
+        return;
+    }
+    for (auto key : ALTERNATE_KEYS) {
+        if (redactString(args, stats, element, key)) {
+            element.removeKey(key);
+        }
+    }
+    redactStructure(args, stats, element.getKey("/K"), seen);
+}
+
+// Redact a destination name entry (a string or name); as destinations are
+// looked up by their exact name, matching names are removed rather than
+// edited, at any scope. Return whether it was removed
+bool redactDestination(args_t &args, stats_t &stats, QPDFObjectHandle dict,
+                       const string &key) {
+    auto value = dict.getKey(key);
+    auto name = value.isString() ? value.getUTF8Value()
+                : value.isName() ? value.getName().substr(1)
+                                 : "";
+    if (name.empty() ||
+        !searchRules(args.rules, args.scope, name, stats.page.regex_time)) {
+        return false;
+    }
+    stats.matches[args.scope]++;
+    dict.removeKey(key);
+    return true;
+}
+
+// Test whether an action requiring a destination (a go-to action, whether to
+// a destination of this document, another or an embedded one) has none, e.g.
+// having had it removed by redactDestination
+bool lostDestination(QPDFObjectHandle action) {
+    if (!action.isDictionary() || action.hasKey("/D")) {
+        return false;
+    }
+    auto type = action.getKey("/S");
+    return type.isNameAndEquals("/GoTo") || type.isNameAndEquals("/GoToR") ||
+           type.isNameAndEquals("/GoToE");
+}
+
+bool redactActions(args_t &args, stats_t &stats, document_t &doc,
+                   QPDFObjectHandle dict, const string &key);
+
+// Redact the strings of an action (a URI, file to launch or open, or named
+// destination) and of the actions following it, each only once; return
+// whether to redact the entire page
+bool redactAction(args_t &args, stats_t &stats, document_t &doc,
+                  QPDFObjectHandle action) {
+    if (!action.isDictionary()) {
+        return false;
+    }
+    auto id = action.getObjGen();
+    if (action.isIndirect()) {
+        auto found = doc.redacted.find(id);
+        if (found != doc.redacted.end()) {
+            return found->second;
+        }
+        doc.redacted[id] = false;
+    }
+
+    // Files are given by a string, or by a file specification (or Windows
+    // launch parameters) dictionary of strings
+    auto redact = redactString(args, stats, action, "/URI") ||
+                  redactString(args, stats, action, "/F");
+    for (auto dict : {action.getKey("/F"), action.getKey("/Win")}) {
+        if (!redact && dict.isDictionary()) {
+            for (auto key : {"/F", "/UF", "/D", "/P"}) {
+                redact = redact || redactString(args, stats, dict, key);
+            }
+        }
+    }
+    if (!redact) {
+        redactDestination(args, stats, action, "/D");
+        redact = redactActions(args, stats, doc, action, "/Next");
+    }
+
+    if (action.isIndirect()) {
+        doc.redacted[id] = redact;
+    }
+    return redact;
+}
+
+// Redact the action (or array of actions) of a dictionary entry, e.g. the
+// action of an outline item, removing any left without a destination (as a
+// go-to action without one is invalid); return whether to redact the entire
+// page
+bool redactActions(args_t &args, stats_t &stats, document_t &doc,
+                   QPDFObjectHandle dict, const string &key) {
+    auto value = dict.getKey(key);
+    if (!value.isArray()) {
+        if (redactAction(args, stats, doc, value)) {
+            return true;
+        }
+        if (lostDestination(value)) {
+            dict.removeKey(key);
+        }
+        return false;
+    }
+
+    // Work backwards, so that removing an action doesn't move those still to
+    // be redacted
+    for (auto i = value.getArrayNItems() - 1; i >= 0; i--) {
+        auto item = value.getArrayItem(i);
+        if (redactAction(args, stats, doc, item)) {
+            return true;
+        }
+        if (lostDestination(item)) {
+            value.eraseItem(i);
+        }
+    }
+    return false;
+}
+
+// Redact a list of outline items (bookmarks), along with the items nested
+// under each; as outlines belong to no page, items that would require
+// redacting a page have their title blanked or action removed instead
+void redactOutlines(args_t &args, stats_t &stats, document_t &doc,
+                    QPDFObjectHandle item, set<QPDFObjGen> &seen) {
+    for (; item.isDictionary(); item = item.getKey("/Next")) {
+        if (item.isIndirect() && !seen.insert(item.getObjGen()).second) {
+            return;
+        }
+        if (redactString(args, stats, item, "/Title")) {
+            item.replaceKey("/Title", QPDFObjectHandle::newUnicodeString(""));
+        }
+        redactDestination(args, stats, item, "/Dest");
+        if (redactActions(args, stats, doc, item, "/A")) {
+            item.removeKey("/A");
+        }
+        redactOutlines(args, stats, doc, item.getKey("/First"), seen);
+    }
+}
+
+// Redact the names of a name tree of destinations, removing the entries with
+// matching names
+void redactNameTree(args_t &args, stats_t &stats, QPDFObjectHandle node,
+                    set<QPDFObjGen> &seen) {
+    if (!node.isDictionary() ||
+        (node.isIndirect() && !seen.insert(node.getObjGen()).second)) {
+        return;
+    }
+
+    // Leaves hold pairs of names and values; work backwards, so that
+    // removing a pair doesn't move those still to be tested
+    auto names = node.getKey("/Names");
+    if (names.isArray()) {
+        for (auto i = names.getArrayNItems() / 2 * 2 - 2; i >= 0; i -= 2) {
+            auto name = names.getArrayItem(i);
+            if (name.isString() &&
+                searchRules(args.rules, args.scope, name.getUTF8Value(),
+                            stats.page.regex_time)) {
+                stats.matches[args.scope]++;
+                names.eraseItem(i + 1);
+                names.eraseItem(i);
+            }
+        }
+    }
+    auto kids = node.getKey("/Kids");
+    if (kids.isArray()) {
+        for (auto &kid : kids.getArrayAsVector()) {
+            redactNameTree(args, stats, kid, seen);
+        }
+    }
+
+    // Keep the limits (the least and greatest names below the node, as names
+    // and kids are in order) in step with the names removed
+    if (!node.hasKey("/Limits")) {
+        return;
+    }
+    vector<QPDFObjectHandle> limits;
+    if (names.isArray() && names.getArrayNItems() >= 2) {
+        limits = {names.getArrayItem(0),
+                  names.getArrayItem(names.getArrayNItems() / 2 * 2 - 2)};
+    } else if (kids.isArray()) {
+        for (auto &kid : kids.getArrayAsVector()) {
+            auto range = kid.isDictionary() ? kid.getKey("/Limits")
+                                            : QPDFObjectHandle::newNull();
+            if (!range.isArray() || range.getArrayNItems() != 2) {
+                continue;
+            } else if (limits.empty()) {
+                limits = range.getArrayAsVector();
+            } else {
+                limits[1] = range.getArrayItem(1);
+            }
+        }
+    }
+    if (limits.empty()) {
+        node.removeKey("/Limits");
+    } else {
+        node.replaceKey("/Limits", QPDFObjectHandle::newArray(limits));
+    }
+}
+
+// Redact the navigation of a document in a single pass over its catalog:
+// outline titles, named destinations, and the actions of the outlines and of
+// the document as it's opened
+void redactNavigation(args_t &args, stats_t &stats, document_t &doc,
+                      QPDF &pdf) {
+    auto root = pdf.getRoot();
+    set<QPDFObjGen> seen;
+    auto outlines = root.getKey("/Outlines");
+    if (outlines.isDictionary()) {
+        redactOutlines(args, stats, doc, outlines.getKey("/First"), seen);
+    }
+
+    // Named destinations are held either in a name tree, or (in older
+    // documents) a dictionary
+    auto names = root.getKey("/Names");
+    if (names.isDictionary()) {
+        redactNameTree(args, stats, names.getKey("/Dests"), seen);
+    }
+    auto dests = root.getKey("/Dests");
+    if (dests.isDictionary()) {
+        // Here, the names are the keys of the dictionary
+        for (auto &key : dests.getKeys()) {
+            if (searchRules(args.rules, args.scope, key.substr(1),
+                            stats.page.regex_time)) {
+                stats.matches[args.scope]++;
+                dests.removeKey(key);
+            }
+        }
+    }
+
+    if (redactActions(args, stats, doc, root, "/OpenAction")) {
+        root.removeKey("/OpenAction");
+    }
+}
+
+void redactPdf(args_t &args, stats_t &stats, QPDF &pdf, int fd);
+
+// Redact an embedded file (given by its file specification) if it's a PDF,
+// as a document of its own parsed from and written to memory, each only once
+void redactAttachment(args_t &args, stats_t &stats, document_t &doc,
+                      QPDFObjectHandle spec) {
+    if (!spec.isDictionary()) {
+        return;
+    }
+    auto file = QPDFFileSpecObjectHelper(spec).getEmbeddedFileStream();
+    if (!file.isStream() || doc.redacted.count(file.getObjGen())) {
+        return;
+    }
+    doc.redacted[file.getObjGen()] = false;
+
+    // The header may be anywhere in the first kilobyte of the file
+    auto data = file.getStreamData();
+    string header((char *)data->getBuffer(),
+                  min(data->getSize(), size_t(1024)));
+    if (header.find("%PDF-") == string::npos) {
+        return;
+    }
+    auto id = file.getObjGen().getObj();
+    Span span("attachment", "object", id);
+    auto description = "embedded file in object " + to_string(id);
+
+    // The attachment is redacted as a document of its own (with its own
+    // record of shared objects); the profile of the page it's attached to is
+    // kept aside
+    auto page = stats.page;
+    string output;
+    try {
+        QPDF pdf;
+        pdf.processMemoryFile(description.c_str(), (char *)data->getBuffer(),
+                              data->getSize());
+        redactPdf(args, stats, pdf, 0);
+        QPDFPageDocumentHelper(pdf).removeUnreferencedResources();
+        QPDFWriter writer(pdf);
+        writer.setOutputMemory();
+        writer.write();
+        auto buffer = writer.getBufferSharedPointer();
+        output.assign((char *)buffer->getBuffer(), buffer->getSize());
+    } catch (exception &e) {
+        throw runtime_error(description + ": " + e.what());
+    }
+    stats.page = page;
+
+    file.replaceStreamData(output, QPDFObjectHandle::newNull(),
+                           QPDFObjectHandle::newNull());
+
+    // The size of the file has changed, invalidating its checksum
+    auto size = QPDFObjectHandle::newInteger(output.size());
+    if (file.getDict().hasKey("/DL")) {
+        file.getDict().replaceKey("/DL", size);
+    }
+    auto params = file.getDict().getKey("/Params");
+    if (params.isDictionary()) {
+        params.replaceKey("/Size", size);
+        params.removeKey("/CheckSum");
+    }
+}
+
+// Test whether an optional content group is one being removed
+bool removedGroup(args_t &args, QPDFObjectHandle group) {
+    if (!group.isDictionaryOfType("/OCG")) {
+        return false;
+    }
+    auto name = group.getKey("/Name");
+    return name.isString() && args.layers.count(name.getUTF8Value());
+}
+
+// Test whether optional content (given by a group, or a membership dictionary
+// of groups) belongs to a layer being removed; content belonging to a
+// membership dictionary is removed along with any of its groups
+bool removedLayer(args_t &args, QPDFObjectHandle content) {
+    if (!content.isDictionaryOfType("/OCMD")) {
+        return removedGroup(args, content);
+    }
+    auto groups = content.getKey("/OCGs");
+    if (!groups.isArray()) {
+        return removedGroup(args, groups);
+    }
+    for (auto &group : groups.getArrayAsVector()) {
+        if (removedGroup(args, group)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Get the names of the resources belonging to layers being removed
+layers_t getLayers(args_t &args, QPDFObjectHandle resources) {
+    layers_t layers;
+    if (args.layers.empty() || !resources.isDictionary()) {
+        return layers;
+    }
+    auto properties = resources.getKey("/Properties");
+    if (properties.isDictionary()) {
+        for (auto &entry : properties.getDictAsMap()) {
+            if (removedLayer(args, entry.second)) {
+                layers.properties.insert(entry.first);
+            }
+        }
+    }
+    auto xobjects = resources.getKey("/XObject");
+    if (xobjects.isDictionary()) {
+        for (auto &entry : xobjects.getDictAsMap()) {
+            if (entry.second.isStream() &&
+                removedLayer(args, entry.second.getDict().getKey("/OC"))) {
+                layers.xobjects.insert(entry.first);
+            }
+        }
+    }
+    return layers;
+}
+
+// Remove the groups being removed from an array of optional content groups
+// (or nested arrays of them, e.g. the order in which a viewer lists them)
+void removeGroups(args_t &args, QPDFObjectHandle groups) {
+    if (!groups.isArray()) {
+        return;
+    }
+    for (auto i = groups.getArrayNItems() - 1; i >= 0; i--) {
+        auto group = groups.getArrayItem(i);
+        if (group.isArray()) {
+            removeGroups(args, group);
+        } else if (removedGroup(args, group)) {
+            groups.eraseItem(i);
+        }
+    }
+}
+
+// Remove the layers being removed from the optional content properties of a
+// document, so that viewers no longer list them
+void removeLayers(args_t &args, QPDF &pdf) {
+    auto properties = pdf.getRoot().getKey("/OCProperties");
+    if (args.layers.empty() || !properties.isDictionary()) {
+        return;
+    }
+    removeGroups(args, properties.getKey("/OCGs"));
+
+    // Groups are also listed by the default configuration and any others,
+    // along with their usage
+    vector<QPDFObjectHandle> configs{properties.getKey("/D")};
+    auto others = properties.getKey("/Configs");
+    if (others.isArray()) {
+        for (auto &config : others.getArrayAsVector()) {
+            configs.push_back(config);
+        }
+    }
+    for (auto &config : configs) {
+        if (!config.isDictionary()) {
+            continue;
+        }
+        for (auto key : {"/ON", "/OFF", "/Order", "/Locked", "/RBGroups"}) {
+            removeGroups(args, config.getKey(key));
+        }
+        auto usages = config.getKey("/AS");
+        if (usages.isArray()) {
+            for (auto &usage : usages.getArrayAsVector()) {
+                if (usage.isDictionary()) {
+                    removeGroups(args, usage.getKey("/OCGs"));
+                }
+            }
+        }
+    }
+}
+
+bool redactPage(args_t &args, stats_t &stats, document_t &doc,
+                QPDFPageObjectHelper &page);
+bool redactResources(args_t &args, stats_t &stats, document_t &doc,
+                     QPDFObjectHandle resources);
+bool redactStreams(args_t &args, stats_t &stats, document_t &doc,
+                   vector<QPDFObjectHandle> &streams);
+
+// Redact the appearance streams of an annotation as form XObjects, each only
+// once (as they are often shared, e.g. by check boxes); return whether to
+// redact the entire page
+bool redactAppearances(args_t &args, stats_t &stats, document_t &doc,
+                       QPDFObjectHandle annot) {
+    auto streams = getAppearances(annot);
+    return redactStreams(args, stats, doc, streams);
+}
+
+// Redact the text, appearance streams and action of an annotation, along with
+// the form field values of a widget; return whether to redact the entire page
+bool redactAnnotation(args_t &args, stats_t &stats, document_t &doc,
+                      QPDFAnnotationObjectHelper &annot) {
+    auto object = annot.getObjectHandle();
+    Span span("annotation", "object", object.getObjGen().getObj());
+    if (redactString(args, stats, object, "/Contents") ||
+        redactRichText(args, stats, object, "/RC")) {
+        return true;
+    }
+    if (annot.getSubtype() == "/Widget" &&
+        redactFields(args, stats, doc, object)) {
+        return true;
+    }
+    redactDestination(args, stats, object, "/Dest");
+    if (redactActions(args, stats, doc, object, "/A")) {
+        return true;
+    }
+    if (annot.getSubtype() == "/FileAttachment") {
+        redactAttachment(args, stats, doc, object.getKey("/FS"));
+    }
+    return redactAppearances(args, stats, doc, object);
+}
+
+// Redact the fields of an interactive form (and their widgets) not reached
+// through the annotations of a remaining page, e.g. hidden fields or those on
+// removed pages; widgets that would require redacting their page have their
+// appearances removed instead
+void redactForm(args_t &args, stats_t &stats, document_t &doc,
+                QPDFObjectHandle fields, set<QPDFObjGen> &seen) {
+    if (!fields.isArray()) {
+        return;
+    }
+    for (auto &field : fields.getArrayAsVector()) {
+        if (!field.isDictionary() ||
+            (field.isIndirect() && !seen.insert(field.getObjGen()).second)) {
+            continue;
+        }
+        if (!field.isIndirect()) {
+            redactField(args, stats, field);
+        } else if (!doc.redacted.count(field.getObjGen())) {
+            doc.redacted[field.getObjGen()] =
+                redactField(args, stats, field);
+        }
+        if (redactAppearances(args, stats, doc, field)) {
+            field.removeKey("/AP");
+        }
+        redactForm(args, stats, doc, field.getKey("/Kids"), seen);
+    }
+}
+
+// Redact the data (datasets) of an XFA form held in a stream, which is either
+// the datasets packet itself or a whole XDP document containing it. As the
+// data belongs to no page, matching text is blanked instead
+void redactDatasets(args_t &args, stats_t &stats, QPDFObjectHandle stream,
+                    bool packet) {
+    Span span("xfa", "object", stream.getObjGen().getObj());
+    auto data = stream.getStreamData();
+    string xml((char *)data->getBuffer(), data->getSize());
+
+    // Only scan the datasets element, leaving the template (i.e. the layout
+    // and captions of the form) as is
+    auto begin = xml.find("<xfa:datasets");
+    auto end = xml.rfind("</xfa:datasets>");
+    if (begin == string::npos || end == string::npos || end < begin) {
+        if (!packet) {
+            return;
+        }
+        begin = 0;
+        end = xml.size();
+    }
+    string redacted;
+    redacted.reserve(xml.size());
+    redacted.append(xml, 0, begin);
+    auto matches = totalMatches(stats);
+    redactXml(args, stats, xml, begin, end, redacted, false);
+    if (totalMatches(stats) != matches) {
+        redacted.append(xml, end, string::npos);
+        stream.replaceStreamData(redacted, QPDFObjectHandle::newNull(),
+                                 QPDFObjectHandle::newNull());
+    }
+}
+
+// Redact the data of the XFA form of an interactive form, if any: a single XDP
+// stream, or an array of packet names and streams
+void redactXfa(args_t &args, stats_t &stats, QPDFObjectHandle form) {
+    auto xfa = form.getKey("/XFA");
+    if (xfa.isStream()) {
+        redactDatasets(args, stats, xfa, false);
+    } else if (xfa.isArray()) {
+        auto packets = xfa.getArrayAsVector();
+        for (size_t i = 0; i + 1 < packets.size(); i += 2) {
+            if (packets[i].isString() &&
+                packets[i].getUTF8Value() == "datasets" &&
+                packets[i + 1].isStream()) {
+                redactDatasets(args, stats, packets[i + 1], true);
+            }
+        }
+    }
+}
+
+// Redact content streams (e.g. form XObjects), each only once; return whether
+// to redact the entire page
+bool redactStreams(args_t &args, stats_t &stats, document_t &doc,
+                   vector<QPDFObjectHandle> &streams) {
+    for (auto &stream : streams) {
+        // Streams are marked before being redacted, so that those drawing
+        // themselves (directly or not) are only redacted once
+        auto id = stream.getObjGen();
+        auto found = doc.redacted.find(id);
+        if (found != doc.redacted.end()) {
+            if (found->second) {
+                return true;
+            }
+            continue;
+        }
+        doc.redacted[id] = false;
+        QPDFPageObjectHelper content(stream);
+        Span span("content", "object", id.getObj());
+        auto redact = redactPage(args, stats, doc, content);
+        doc.redacted[id] = redact;
+        if (redact) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Redact the glyph procedures of a Type3 font, along with the resources they
+// use, each font only once; return whether to redact the entire page
+bool redactType3(args_t &args, stats_t &stats, document_t &doc,
+                 QPDFObjectHandle font) {
+    auto procs = getStreams(font.getKey("/CharProcs"));
+    if (!font.isIndirect()) {
+        // Direct fonts can't be marked as redacted, so to avoid cycles their
+        // resources are skipped
+        return redactStreams(args, stats, doc, procs);
+    }
+    auto id = font.getObjGen();
+    auto found = doc.redacted.find(id);
+    if (found != doc.redacted.end()) {
+        return found->second;
+    }
+    doc.redacted[id] = false;
+    auto redact = redactStreams(args, stats, doc, procs) ||
+                  redactResources(args, stats, doc, font.getKey("/Resources"));
+    doc.redacted[id] = redact;
+    return redact;
+}
+
+// Redact the content streams found among resources: form XObjects, tiling
+// patterns (shading patterns being dictionaries rather than streams) and the
+// glyph procedures of Type3 fonts; return whether to redact the entire page
+bool redactResources(args_t &args, stats_t &stats, document_t &doc,
+                     QPDFObjectHandle resources) {
+    if (!resources.isDictionary()) {
+        return false;
+    }
+    auto forms = getStreams(resources.getKey("/XObject"), "/Form");
+    auto patterns = getStreams(resources.getKey("/Pattern"));
+    if (redactStreams(args, stats, doc, forms) ||
+        redactStreams(args, stats, doc, patterns)) {
+        return true;
+    }
+    auto fonts = resources.getKey("/Font");
+    if (fonts.isDictionary()) {
+        for (auto &entry : fonts.getDictAsMap()) {
+            if (entry.second.isDictionaryOfType("/Font", "/Type3") &&
+                redactType3(args, stats, doc, entry.second)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Redact the contents of a page (or of a content stream, such as a form
+// XObject), along with the content streams of its resources; return whether
+// to redact the entire page
+bool redactPage(args_t &args, stats_t &stats, document_t &doc,
+                QPDFPageObjectHelper &page) {
+    auto object = page.getObjectHandle();
+    Span span("redactPage", "object", object.getObjGen().getObj());
+
+    // Loop through each page contents, testing for matches
+    auto resources = getResources(page);
+    auto layers = getLayers(args, resources);
+    vector<QPDFObjectHandle> contents;
+    for (auto &obj : getContents(object)) {
+        Filter filter(args.rules, args.scope, stats, layers);
+        auto id = obj.getObjGen().getObj();
+        [[maybe_unused]] auto decoded = stats.decoded;
+        auto start = chrono::steady_clock::now();
+        {
+            Span span("filterAsContents", "object", id);
+            PROBE(stream__filter__start, id);
+            obj.filterAsContents(&filter);
+            PROBE(stream__filter__end, id, stats.decoded - decoded,
+                  filter.data().size());
+        }
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+        // Profile the stream, adding it to the profile of the page
+        auto &profile = filter.profile();
+        profile.object = id;
+        profile.page = stats.page.page;
+        profile.streams = 1;
+        profile.time = elapsed.count();
+        keepSlowest(stats.slowest_streams, profile);
+        mergeProfile(stats.page, profile);
+
+        if (!filter.redact() && !filter.removed()) {
+            stats.streams_skipped++;
+        } else {
+            // Streams only having had layers removed are simply updated
+            stats.streams_touched++;
+            switch (filter.redact() ? args.scope : s_match) {
+            case s_page:
+                // For page-scoped redactions, simply bail here
+                return true;
+            case s_stream:
+                // For stream-scoped redactions, omit the stream
+                continue;
+            default:
+                // For all other redactions, update the stream data
+                stats.encoded += filter.data().size();
+                obj.replaceStreamData(filter.data(),
+                                      QPDFObjectHandle::newNull(),
+                                      QPDFObjectHandle::newNull());
+                if (args.verify) {
+                    verifyStream(args, obj);
+                }
+            }
+        }
+        contents.push_back(obj);
+    }
+    setContents(object, contents);
+
+    // Iterate through the resources, including nested content streams
+    if (redactProperties(args, stats, resources) ||
+        redactResources(args, stats, doc, resources)) {
+        return true;
+    }
+
+    // Iterate through the annotations of a page, after its metadata
+    if (object.isPageObject()) {
+        if (redactXmp(args, stats, object)) {
+            return true;
+        }
+        for (auto &annot : page.getAnnotations()) {
+            if (redactAnnotation(args, stats, doc, annot)) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+// Redact the pages of a document (reporting progress to the given file
+// descriptor, if any), followed by the parts of the document belonging to no
+// page
+void redactPdf(args_t &args, stats_t &stats, QPDF &pdf, int fd) {
+    // Loop through each page, redacting as necessary
+    document_t doc{};
+    QPDFPageDocumentHelper helper(pdf);
+    auto pages = helper.getAllPages();
+    Progress progress(fd, pages.size());
+    auto index = 0;
+    for (auto &page : pages) {
+        // Besides its streams, a page is touched by any redaction made along
+        // with it (e.g. of its annotations, fields or metadata)
+        auto touched = stats.streams_touched;
+        auto matches = totalMatches(stats);
+        stats.page = {};
+        stats.page.object = page.getObjectHandle().getObjGen().getObj();
+        stats.page.page = index;
+        auto start = chrono::steady_clock::now();
+        PROBE(page__start, index);
+        auto removed = redactPage(args, stats, doc, page);
+        PROBE(page__end, index, removed);
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+        recordPage(stats, elapsed.count());
+        progress.update(++index, stats);
+        if (removed) {
+            helper.removePage(page);
+            stats.pages_removed++;
+            stats.pages_touched++;
+        } else if (stats.streams_touched != touched ||
+                   totalMatches(stats) != matches) {
+            stats.pages_touched++;
+        } else {
+            stats.pages_skipped++;
+        }
+    }
+
+    // Redact the remainder of the interactive form, if any
+    auto form = pdf.getRoot().getKey("/AcroForm");
+    if (form.isDictionary()) {
+        Span span("form");
+        set<QPDFObjGen> seen;
+        redactForm(args, stats, doc, form.getKey("/Fields"), seen);
+        redactXfa(args, stats, form);
+    }
+
+    // Redact the metadata, navigation (e.g. outlines) and structure tree of
+    // the document, which belong to no page
+    {
+        Span span("metadata");
+        redactMetadata(args, stats, pdf);
+    }
+    {
+        Span span("navigation");
+        redactNavigation(args, stats, doc, pdf);
+    }
+    removeLayers(args, pdf);
+    auto structure = pdf.getRoot().getKey("/StructTreeRoot");
+    if (structure.isDictionary()) {
+        Span span("structure");
+        set<QPDFObjGen> seen;
+        redactStructure(args, stats, structure.getKey("/K"), seen);
+    }
+
+    // Redact the documents attached to the document
+    for (auto &entry : QPDFEmbeddedFileDocumentHelper(pdf).getEmbeddedFiles()) {
+        redactAttachment(args, stats, doc, entry.second->getObjectHandle());
+    }
+}
+
+// Redact a single document, writing it to the outfile, or editing it in place
+// if no outfile is given
+void redactDocument(args_t &args, stats_t &stats, const char *infile,
+                    const char *outfile) {
+    QPDF pdf;
+    {
+        Timer timer(stats, p_parse);
+        Span span("parse");
+        pdf.processFile(infile);
+        PROBE(document__open, infile);
+    }
+
+    {
+        Timer timer(stats, p_redact);
+        redactPdf(args, stats, pdf, args.progress);
+    }
+
+    // Remove any resources (e.g. fonts) that are no longer used once the
+    // desired text has been redacted
+    {
+        Timer timer(stats, p_prune);
+        Span span("prune");
+        QPDFPageDocumentHelper(pdf).removeUnreferencedResources();
+    }
+
+    // If no outfile was provided (indicating an in-place edit), generate a
+    // temporary file based on the infile
+    auto tmpfile = outfile ? outfile : string(infile) + "~";
+
+    {
+        Timer timer(stats, p_write);
+        Span span("write");
+        PROBE(write__start, tmpfile.c_str());
+        QPDFWriter writer(pdf, tmpfile.c_str());
+        writer.write();
+        PROBE(write__end, tmpfile.c_str());
+    }
+
+    if (!outfile) {
+        // Replace the infile with the temporary file
+        pdf.closeInputSource();
+        QUtil::remove_file(infile);
+        QUtil::rename_file(tmpfile.c_str(), infile);
+    }
+}
+
+// Add the statistics collected for a document to those for a batch
+void mergeStats(stats_t &total, const stats_t &stats) {
+    total.documents_ok += stats.documents_ok;
+    total.documents_failed += stats.documents_failed;
+    for (auto i = 0; i < 4; i++) {
+        total.time[i].first += stats.time[i].first;
+        total.time[i].second += stats.time[i].second;
+        total.allocated[i] += stats.allocated[i];
+    }
+    total.decoded += stats.decoded;
+    total.encoded += stats.encoded;
+    total.tokens += stats.tokens;
+    total.frames += stats.frames;
+    total.layers += stats.layers;
+    for (auto i = 0; i < 6; i++) {
+        total.matches[i] += stats.matches[i];
+    }
+    total.pages_touched += stats.pages_touched;
+    total.pages_skipped += stats.pages_skipped;
+    total.pages_removed += stats.pages_removed;
+    total.streams_touched += stats.streams_touched;
+    total.streams_skipped += stats.streams_skipped;
+    for (auto i = 0; i < 14; i++) {
+        total.page_buckets[i] += stats.page_buckets[i];
+    }
+    total.page_seconds += stats.page_seconds;
+    for (auto &profile : stats.slowest_pages) {
+        keepSlowest(total.slowest_pages, profile);
+    }
+    for (auto &profile : stats.slowest_streams) {
+        keepSlowest(total.slowest_streams, profile);
+    }
+}
+
+// Class implementing a streaming quantile sketch (in the manner of DDSketch);
+// values are counted in logarithmically-sized buckets, so that quantiles are
+// accurate to within 1% using memory bounded by the range of the values rather
+// than by their number
+class Sketch {
+    const double _gamma = 1.02;
+    map<int, size_t> _buckets;
+    size_t _count = 0;
+
+  public:
+    void add(double value) {
+        _buckets[int(ceil(log(max(value, 1e-9)) / log(_gamma)))]++;
+        _count++;
+    }
+
+    double quantile(double q) {
+        if (!_count) {
+            return 0;
+        }
+        auto rank = q * (_count - 1);
+        size_t seen = 0;
+        for (auto &bucket : _buckets) {
+            seen += bucket.second;
+            if (seen > rank) {
+                return 2 * pow(_gamma, bucket.first) / (_gamma + 1);
+            }
+        }
+        return 0;
+    }
+};
+
+// Redact each document listed (one per line, optionally followed by a tab and
+// the outfile) in the given file, or standard input if "-"; print a summary of
+// each document as a line of JSON, followed by a summary of the batch
+void redactBatch(args_t &args, stats_t &total) {
+    ifstream file;
+    if (string(args.batch) != "-") {
+        file.open(args.batch);
+        if (!file) {
+            throw runtime_error(string("unable to read ") + args.batch);
+        }
+    }
+    auto &list = file.is_open() ? file : cin;
+
+    Sketch latency;
+    double bytes = 0;
+    auto start = chrono::steady_clock::now();
+    for (string line; getline(list, line);) {
+        if (line.empty()) {
+            continue;
+        }
+        auto tab = line.find('\t');
+        auto infile = line.substr(0, tab);
+        auto outfile = tab == string::npos ? "" : line.substr(tab + 1);
+
+        stats_t stats{};
+        string error;
+        struct stat info;
+        auto size = stat(infile.c_str(), &info) ? 0 : info.st_size;
+        auto begin = chrono::steady_clock::now();
+        try {
+            redactDocument(args, stats, infile.c_str(),
+                           outfile.empty() ? nullptr : outfile.c_str());
+            stats.documents_ok++;
+        } catch (exception &e) {
+            stats.documents_failed++;
+            error = e.what();
+        }
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - begin;
+        latency.add(elapsed.count());
+        bytes += size;
+        mergeStats(total, stats);
+
+        auto matches = totalMatches(stats);
+        cout << "{\"file\": " << jsonString(infile) << ", \"bytes\": " << size
+             << ", \"pages\": " << stats.pages_touched + stats.pages_skipped
+             << ", \"time\": " << elapsed.count() << ", \"phases\": {";
+        for (auto i = 0; i < 4; i++) {
+            cout << (i ? ", " : "") << "\"" << PHASE_NAMES[i]
+                 << "\": " << stats.time[i].first;
+        }
+        cout << "}, \"matches\": " << matches << ", \"outcome\": "
+             << (error.empty() ? "\"ok\"" : "\"error\"");
+        if (!error.empty()) {
+            cout << ", \"error\": " << jsonString(error);
+        }
+        cout << "}" << endl;
+    }
+
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    auto documents = total.documents_ok + total.documents_failed;
+    auto pages = total.pages_touched + total.pages_skipped;
+    cout << "{\"documents\": " << documents
+         << ", \"failed\": " << total.documents_failed
+         << ", \"time\": " << elapsed.count() << ", \"latency\": {\"p50\": "
+         << latency.quantile(0.5) << ", \"p90\": " << latency.quantile(0.9)
+         << ", \"p99\": " << latency.quantile(0.99)
+         << "}, \"throughput\": {\"documents\": "
+         << documents / elapsed.count()
+         << ", \"pages\": " << pages / elapsed.count()
+         << ", \"megabytes\": " << bytes / 1e6 / elapsed.count() << "}}"
+         << endl;
+}
+
+int main(int argc, char *argv[]) {
+    args_t args{};
+    stats_t stats{};
+    parseArgs(argc, argv, args);
+    if (args.trace) {
+        trace.open(args.trace);
+    }
+
+    try {
+        // When only profiling, there is no matching or writing to be done
+        if (args.profile) {
+            QPDF pdf;
+            pdf.processFile(args.infile);
+            PROBE(document__open, args.infile);
+            profileDocument(cout, pdf);
+            return 0;
+        }
+
+        compileRules(args);
+        if (args.batch) {
+            redactBatch(args, stats);
+        } else {
+            redactDocument(args, stats, args.infile, args.outfile);
+            stats.documents_ok++;
+        }
+
+        trace.write();
+    } catch (exception &e) {
+        cerr << args.whoami << ": " << e.what() << endl;
+        stats.documents_failed++;
+
+        // Still save the trace and metrics of the failed run, reporting any
+        // error doing so rather than throwing from here
+        try {
+            trace.write();
+        } catch (exception &e) {
+            cerr << args.whoami << ": " << e.what() << endl;
+        }
+        try {
+            if (args.metrics) {
+                writeMetrics(args, stats);
+            }
+        } catch (exception &e) {
+            cerr << args.whoami << ": " << e.what() << endl;
+        }
+        exit(2);
+    }
+
+    if (args.metrics) {
+        writeMetrics(args, stats);
+    }
+
+    // Keep the JSON Lines of a batch alone on standard output
+    if (args.stats) {
+        printStats(args.batch ? cerr : cout, args, stats);
     }
 
-    return 0;
+    return stats.documents_failed ? 2 : 0;
 }